@@ -5,31 +5,48 @@
 #include <vector>
 #include <iostream>
 #include <map>
+#include <set>
 
 #include <dorset-lang/Utils/Error.h>
 
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/STLExtras.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/MC/TargetRegistry.h>
+#include <llvm/Object/ArchiveWriter.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/StandardInstrumentations.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/TargetParser/Host.h>
 #include <llvm/TargetParser/Triple.h>
 #include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/IPO/ArgumentPromotion.h>
+#include <llvm/Transforms/IPO/GlobalDCE.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Transforms/IPO/SCCP.h>
+#include <llvm/Transforms/Instrumentation/InstrProfiling.h>
+#include <llvm/Transforms/Instrumentation/PGOInstrumentation.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Scalar/GVN.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
 #include <llvm/Linker/Linker.h>
@@ -44,13 +61,32 @@ namespace Dorset
         Function *getFunction(std::string Name);
         AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, const std::string &VarName, Type* type);
     
+        /// SourceLocation - A line and column in the source, for debug info.
+        struct SourceLocation
+        {
+            int Line = 0;
+            int Col = 0;
+        };
 
         /// ExprAST - Base class for all expression nodes.
         class ExprAST
         {
+            SourceLocation Loc;
+
         public:
+            ExprAST();
             virtual ~ExprAST() = default;
             virtual Value *codegen() = 0;
+
+            int getLine() const;
+            int getCol() const;
+            /// Nodes are built after their operands, point them back at their own token.
+            void setLocation(SourceLocation NewLoc);
+
+            /// Adds the name of every variable or array this expression writes to.
+            virtual void collectAssignedNames(std::set<std::string> &Names);
+            /// True if the expression is side effect free and reads nothing in 'Assigned'.
+            virtual bool isLoopInvariant(const std::set<std::string> &Assigned);
         };
 
         /// NumberExprAST - Expression class for numeric literals like "1.0".
@@ -61,6 +97,18 @@ namespace Dorset
         public:
             NumberExprAST(double Val);
             Value *codegen() override;
+            bool isLoopInvariant(const std::set<std::string> &Assigned) override;
+        };
+
+        /// BoolExprAST - Expression class for the 'true' and 'false' literals.
+        class BoolExprAST : public ExprAST
+        {
+            bool Val;
+
+        public:
+            BoolExprAST(bool Val);
+            Value *codegen() override;
+            bool isLoopInvariant(const std::set<std::string> &Assigned) override;
         };
 
         class StringExprAST : public ExprAST
@@ -80,6 +128,7 @@ namespace Dorset
         public:
             VariableExprAST(const std::string &Name);
             Value *codegen() override;
+            bool isLoopInvariant(const std::set<std::string> &Assigned) override;
             const std::string& getName();
         };
 
@@ -93,6 +142,7 @@ namespace Dorset
             VarExprAST(std::string Name, ExprAST* Init);
 
             Value* codegen() override;
+            void collectAssignedNames(std::set<std::string> &Names) override;
         };
 
 
@@ -109,6 +159,7 @@ namespace Dorset
             ArrayExprAST(std::string Name, ExprAST* SizeExpr, std::vector<ExprAST*> Values);
 
             Value* codegen() override;
+            void collectAssignedNames(std::set<std::string> &Names) override;
 
             Value *getSize();
             AllocaInst *getArray();
@@ -123,6 +174,7 @@ namespace Dorset
         public:
             ArrayElementRefExprAST(const std::string &ArrayName, ExprAST *Index);
             Value *codegen() override;
+            void collectAssignedNames(std::set<std::string> &Names) override;
             const std::string& getName();
             Value *getIndex();
         };
@@ -134,9 +186,17 @@ namespace Dorset
             ExprAST *LHS;
             ExprAST *RHS;
 
+            Value *codegenShortCircuit();
+
         public:
             BinaryExprAST(std::string  Op, ExprAST *LHS, ExprAST *RHS);
             Value *codegen() override;
+            void collectAssignedNames(std::set<std::string> &Names) override;
+            bool isLoopInvariant(const std::set<std::string> &Assigned) override;
+
+            const std::string& getOp();
+            ExprAST *getLHS();
+            ExprAST *getRHS();
         };
 
         /// CallExprAST - Expression class for function calls.
@@ -148,6 +208,7 @@ namespace Dorset
         public:
             CallExprAST(const std::string &Callee, std::vector<ExprAST *> Args);
             Value *codegen() override;
+            void collectAssignedNames(std::set<std::string> &Names) override;
         };
 
         /// BlockAST - Represents a block, '{ }'.
@@ -159,6 +220,7 @@ namespace Dorset
             BlockAST(std::vector<ExprAST*> Exprs);
 
             Value *codegen() override;
+            void collectAssignedNames(std::set<std::string> &Names) override;
         };
 
         class PrototypeArgumentAST 
@@ -182,6 +244,8 @@ namespace Dorset
             bool IsOperator;
             unsigned Precedence;
             std::string ReturnType;
+            bool IsExported = false;
+            int Line;
 
         public:
             PrototypeAST(const std::string& Name, std::vector<PrototypeArgumentAST*> Args, std::string ReturnType, bool IsOperator = false, unsigned Prec = 0);
@@ -189,10 +253,16 @@ namespace Dorset
             Function* codegen();
             const std::string& getName() const;
             const std::string& getReturnType() const;
+            const std::vector<PrototypeArgumentAST*>& getArgs() const;
+            int getLine() const;
 
             bool isUnaryOp() const;
             bool isBinaryOp() const;
 
+            /// Exported functions keep external linkage, everything else but 'main' is internal.
+            bool isExported() const;
+            void setExported();
+
             std::string getOperatorName() const;
 
             unsigned getBinaryPrecedence() const;
@@ -207,6 +277,7 @@ namespace Dorset
         public:
             FunctionAST(PrototypeAST *Proto, BlockAST *Body);
             Function *codegen();
+            PrototypeAST *getProto();
         };
 
         /// IfExprAST - Expression class for if/then/else.
@@ -223,9 +294,11 @@ namespace Dorset
             IfExprAST(ExprAST* Cond, ExprAST* Then, ExprAST* Else, bool ThenReturns, bool ElseReturns);
 
             Value* codegen() override;
+            void collectAssignedNames(std::set<std::string> &Names) override;
         };
 
-        /// ForExprAST - Expression class for for/in.
+        /// ForExprAST - Expression class for for/in. Lowered as a guarded loop with a
+        /// preheader, a header holding the induction variable PHI, and a latch.
         class ForExprAST : public ExprAST
         {
             std::string VarName;
@@ -238,6 +311,7 @@ namespace Dorset
             ForExprAST(const std::string& VarName, ExprAST* Start, ExprAST* End, ExprAST* Step, ExprAST* Body);
 
             Value* codegen() override;
+            void collectAssignedNames(std::set<std::string> &Names) override;
         };
 
         /// UnaryExprAST - Expression class for a unary operator.
@@ -250,6 +324,8 @@ namespace Dorset
             UnaryExprAST(char Opcode, ExprAST* Operand);
 
             Value* codegen() override;
+            void collectAssignedNames(std::set<std::string> &Names) override;
+            bool isLoopInvariant(const std::set<std::string> &Assigned) override;
         };
 
         /// ReturnExprAST - Expression that represents the return value of a function.
@@ -261,6 +337,7 @@ namespace Dorset
             ReturnExprAST(ExprAST* Expr);
             
             Value* codegen() override;
+            void collectAssignedNames(std::set<std::string> &Names) override;
         };
 
         class MasterAST
@@ -269,25 +346,49 @@ namespace Dorset
             static inline LLVMContext* TheContext;
             static inline Module* TheModule;
             static inline IRBuilder<>* Builder;
-            static inline std::map<std::string, AllocaInst*> NamedValues;
+            static inline std::map<std::string, Value*> NamedValues;
             static inline std::map<std::string, ArrayExprAST*> Arrays;
             static inline legacy::FunctionPassManager* TheFPM;
             static inline std::map<std::string, PrototypeAST*> FunctionProtos;
-            static inline std::map<std::string, int> BinopPrecedence =
+            static inline unsigned NodeCount = 0;
+            static inline bool InstrumentFunctions = false;
+            static inline bool CountCalls = false;
+            static inline std::map<Function*, GlobalVariable*> CallCounters;
+
+            // Debug info, only when compiling with '-g'. CurLoc follows the parser.
+            static inline SourceLocation CurLoc;
+            static inline DIBuilder* DBuilder = nullptr;
+            static inline DICompileUnit* TheCU = nullptr;
+            static inline std::vector<DIScope*> LexicalBlocks;
+            static inline const std::map<std::string, int> BuiltinBinopPrecedence =
             {
-                {"=",  2 },
-                {"==", 4 },
-                {"<",  10},
-                {"+",  20},
-                {"-",  30},
-                {"*",  40}
+                {"=",   2 },
+                {"or",  3 },
+                {"and", 4 },
+                {"==",  5 },
+                {"!=",  5 },
+                {"<",   10},
+                {">",   10},
+                {"<=",  10},
+                {">=",  10},
+                {"+",   20},
+                {"-",   30},
+                {"*",   40},
+                {"/",   40},
+                {"%",   40}
             };
+            static inline std::map<std::string, int> BinopPrecedence = BuiltinBinopPrecedence;
 
             static void initializeModule(const char* moduleName);
+            static std::pair<std::unique_ptr<LLVMContext>, std::unique_ptr<Module>> releaseModule();
+            static void initializeDebugInfo(const std::string &fileName, const std::string &directory);
+            static void finalizeDebugInfo();
+            static void emitLocation(ExprAST *AST);
         };
 
         void createExternalFunctions();
         void createNewLineFunction();
         void createPrintFunction();
+        void createProfileDump();
     }
 }
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <dorset-lang/AST/AST.h>
+#include <dorset-lang/Utils/Cache.h>
+
+namespace Dorset
+{
+    namespace AST
+    {
+        /// FunctionCache - Keeps the IR of every function definition as bitcode, keyed
+        /// by its tokens and the declarations visible to it, so unchanged functions
+        /// are linked back in instead of being lowered again.
+        class FunctionCache
+        {
+        private:
+            struct CachedFunction
+            {
+                std::string Key;
+                std::string Name;
+                bool IsInternal;
+            };
+
+            CompilationCache cache;
+            std::string baseKey;
+            std::vector<CachedFunction> pending;
+
+        public:
+            FunctionCache(std::string directory, std::string baseKey);
+
+            /// Copies F into a module of its own, declaring everything it calls.
+            static std::unique_ptr<Module> extractFunction(Function *F);
+
+            /// 'names' are the lexemes of the function's tokens, only the callees and
+            /// operators among them are part of the key.
+            std::string computeKey(std::string source, const std::set<std::string> &names);
+            bool reuse(std::string key, PrototypeAST *Proto);
+            void store(std::string key, Function *F);
+            bool linkCachedFunctions();
+        };
+    }
+}
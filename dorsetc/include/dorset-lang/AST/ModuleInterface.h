@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <dorset-lang/AST/AST.h>
+
+namespace Dorset
+{
+    namespace AST
+    {
+        /// ModuleInterface - The binary interface file ('.dsi') of a Dorset source file.
+        /// It holds the file's exported prototypes and the bitcode of the small ones,
+        /// so importing the file is one read of a table instead of lexing and parsing it.
+        class ModuleInterface
+        {
+        private:
+            std::string sourceHash;
+            std::vector<PrototypeAST*> prototypes;
+
+            std::unique_ptr<MemoryBuffer> buffer;
+            StringRef bitcode;
+
+        public:
+            ModuleInterface();
+            ModuleInterface(std::string sourceHash, std::vector<PrototypeAST*> prototypes);
+
+            static std::string getInterfacePath(std::string sourcePath);
+
+            const std::string &getSourceHash() const;
+
+            /// Keeps the bodies of the prototypes small enough to inline, from the current module.
+            void addBodies();
+
+            bool read(std::string path);
+            bool write(std::string path);
+
+            /// Declares every prototype in the current module, with the bodies available
+            /// for inlining but still defined by the imported file's own object.
+            bool import();
+        };
+    }
+}
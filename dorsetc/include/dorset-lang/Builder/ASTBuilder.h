@@ -1,10 +1,12 @@
 #pragma once
 
+#include <set>
 #include <string>
 #include <vector>
 
 #include <dorset-lang/LexicalAnalysis/Token.h>
 #include <dorset-lang/AST/AST.h>
+#include <dorset-lang/AST/FunctionCache.h>
 #include <dorset-lang/Utils/Error.h>
 #include <dorset-lang/Builder/ExpressionBuilder.h>
 
@@ -16,13 +18,16 @@ namespace Dorset
         std::vector<Token> tokens;
         int currentTokenIndex;
         bool needsReturnToken = false;
+        AST::FunctionCache *functionCache;
+        std::string directory;
+        std::set<std::string> imported;
 
         Token currentToken();
         Token advanceToken();
 
         AST::ExprAST *parseExpression(bool& hasReturn);
         AST::PrototypeAST *parsePrototype(); 
-        AST::FunctionAST *parseDefinition(); 
+        AST::FunctionAST *parseDefinition(bool isExported = false); 
         AST::BlockAST *parseBlock(bool& hasReturn);
         AST::PrototypeAST *parseExtern();
 
@@ -30,12 +35,19 @@ namespace Dorset
         AST::ExprAST *parseForExpression(bool& hasReturn);
 
 
-        void handleDefinition(); 
+        std::string getTokenSource(int start, int end);
+        std::set<std::string> getTokenNames(int start, int end);
+        std::string peekDefinitionName();
+
+        void handleDefinition(bool isExported = false); 
         void handleExtern();
+        void handleImport();
 
     public:
-        ASTBuilder(std::vector<Token> tokens);
+        ASTBuilder(std::vector<Token> tokens, AST::FunctionCache *functionCache = nullptr, std::string directory = "");
 
         void parseTokenList();
+        /// Only the prototypes of the exported functions, for importing the file.
+        std::vector<AST::PrototypeAST*> parseExportedPrototypes();
     };
 }
\ No newline at end of file
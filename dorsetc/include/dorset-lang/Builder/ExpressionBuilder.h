@@ -19,6 +19,7 @@ namespace Dorset
         Token advanceToken();
 
         AST::ExprAST *parseNumberExpr();
+        AST::ExprAST *parseBoolExpr();
         AST::ExprAST *parseStringExpr();
         AST::ExprAST *parseParenExpr();
         AST::ExprAST *parseIdentifierExpr();
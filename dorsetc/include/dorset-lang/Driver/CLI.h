@@ -8,10 +8,14 @@
 #include <filesystem>
 
 #include <dorset-lang/LexicalAnalysis/Lexer.h>
+#include <dorset-lang/Utils/Cache.h>
 #include <dorset-lang/Utils/Error.h>
 #include <dorset-lang/Utils/OutputUtils.h>
 #include <dorset-lang/AST/AST.h>
+#include <dorset-lang/AST/ModuleInterface.h>
 #include <dorset-lang/Builder/ASTBuilder.h>
+#include <dorset-lang/Driver/Server.h>
+#include <dorset-lang/Driver/TimeReport.h>
 
 namespace Dorset
 {
@@ -32,21 +36,48 @@ namespace Dorset
         bool isTokens = false;
         bool hasOutputName = false;
         bool isLibrary = false;
+        bool isSharedLibrary = false;
         bool generateLLVMIR = false;
+        bool generateBitcode = false;
+        bool generateAssembly = false;
+        bool objectOnly = false;
         bool deleteBinaries = true;
+        bool useCache = false;
+        bool isServer = false;
+        bool isClient = false;
+        bool isRepl = false;
+        bool isTimeReport = false;
+        bool profileGenerate = false;
+        bool instrumentFunctions = false;
+        bool debugInfo = false;
+        bool isLTO = false;
+        bool emitInterface = false;
 
         bool hadError = false;
 
         std::string sourceFile = "output";
         std::string sourceFileLocation = "output";
+        std::vector<std::string> sourceFileLocations; // Every source, the first is sourceFileLocation.
 
         std::string outputLL;
+        std::string outputBC;
         std::string outputS;
         std::string outputO;
         std::string outputFinal;
 
         std::string rawCode = "";
 
+        std::string cacheDirectory = CompilationCache::defaultDirectory();
+        std::string socketPath = CompileServer::defaultSocketPath();
+        std::string timeReportFile = "";
+        std::string timeTraceFile = "";
+        std::string profileGenerateFile = "";
+        std::string profileUseFile = "";
+
+        std::string targetTriple = sys::getDefaultTargetTriple();
+        std::string targetCPU = "generic";
+        std::string targetFeatures = "";
+
         void advanceArgument();
         std::string currentArgument();
         bool isAtEnd();
@@ -60,6 +91,7 @@ namespace Dorset
         void processFile();
 
         void constructOutputBinaryNames();
+        std::vector<std::string> getServerArguments();
 
     public:
         CompilerOptions(int argc, char *argv[]);
@@ -74,17 +106,48 @@ namespace Dorset
     {
     private:
         CompilerOptions options;
+        std::unique_ptr<TimeReport> timeReport;
+        std::unique_ptr<TargetMachine> targetMachine;
 
         std::string getSourceContents(std::string fileName);
         std::vector<Token> lex(std::string contents);
-        void buildAST(std::vector<Token> tokens);
-
-        void outputBinaries();
+        void buildAST(std::vector<Token> tokens, AST::FunctionCache *functionCache, std::string directory);
+        void buildModule(unsigned index, std::string contents, bool useFunctionCache);
+        void writeInterface(unsigned index, std::string contents);
+        std::vector<std::string> getImportedFiles(std::string contents, std::string directory);
+
+        std::string computeCacheKey(std::string contents);
+        std::string computeFunctionCacheKey(std::string sourceName);
+        std::vector<std::pair<std::string, std::string>> getCachedOutputs();
+        bool restoreFromCache(std::string key);
+        void storeInCache(std::string key);
+
+        void addCount(std::string name, uint64_t value);
+        void printTimeReport();
+        void writeTimeTrace();
+
+        unsigned getModuleCount();
+        std::string getModuleSource(unsigned index);
+        std::string getModuleOutput(unsigned index, std::string extension);
+        bool isBitcodeInput(unsigned index);
+        bool isBitcodeInputPath(std::string path);
+        bool checkBitcodeOutputs();
+        bool isLinked();
+
+        TargetMachine *getTargetMachine();
+        void optimizeModule(TargetMachine *machine, bool isWholeProgram);
+        void emitModule(std::string codeFile, std::string irFile, std::string bitcodeFile, bool isWholeProgram);
+        void writeBitcode(std::string bitcodeFile);
+        void linkBitcode(std::string moduleName, std::vector<std::string> bitcodeFiles);
+        void linkExecutable(std::vector<std::string> objectFiles);
+        void writeArchive(std::vector<std::string> objectFiles);
         void removeBinaries();
 
     public:
         Compiler(CompilerOptions options);
 
+        static void initializeTargets();
+
         int compile();
     };
 }
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <memory>
+#include <map>
+#include <set>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Target/TargetMachine.h>
+
+namespace Dorset
+{
+    namespace AST
+    {
+        class PrototypeAST;
+    }
+
+    /// JitMode - How a JitSession compiles, see JitSession.
+    enum class JitMode
+    {
+        Lazy,
+        Eager,
+        Tiered,
+        Incremental,
+    };
+
+    /// JitSession - Compiles Dorset source in memory with ORC's LLLazyJIT and hands back
+    /// pointers to its functions, without writing any files or running a linker.
+    ///
+    ///     JitSession session;
+    ///     auto square = session.compile(source).lookup<double(double)>("square");
+    ///
+    /// Only exported functions, and 'main', can be looked up. 'main' is always an
+    /// int(...) function that returns 0, like the entry point of a program.
+    /// Everything a session compiles lives as long as the session does.
+    ///
+    /// A lazy session, the default, optimizes and generates code for each function
+    /// only when it is first called, through a stub that jumps to it from then on.
+    /// An eager one generates each source as a whole on its first lookup.
+    ///
+    /// A tiered session instead generates every function straight away without any
+    /// optimization, and counts its calls. A background thread recompiles the ones
+    /// that get hot with the full pipeline and points their stubs at the new code.
+    ///
+    /// An incremental session, for the REPL, sees every function it compiled before,
+    /// exported or not, and a new definition of a function replaces the old one.
+    class JitSession
+    {
+    private:
+        /// TieredFunction - A function of a tiered session, called through a stub of its name.
+        struct TieredFunction
+        {
+            std::string name;
+            uint64_t *calls;
+            std::shared_ptr<llvm::orc::ThreadSafeModule> source; // Unoptimized, for recompiling.
+            bool isPromoted = false;
+        };
+
+        std::unique_ptr<llvm::TargetMachine> targetMachine;
+        std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
+        std::unique_ptr<llvm::orc::LLLazyJIT> jit;
+        std::unique_ptr<llvm::orc::IRCompileLayer> tier0Layer; // Unoptimized code generation, for tiered sessions.
+        std::unique_ptr<llvm::orc::IRCompileLayer> tier1Layer; // Optimized code generation, for promoted functions.
+        JitMode mode;
+        unsigned moduleCount = 0;
+        bool hadError = false;
+
+        // The definitions of an incremental session, and what declares them again.
+        std::set<std::string> builtins;
+        bool hasBuiltins = false;
+        std::map<std::string, llvm::orc::ResourceTrackerSP> definitions;
+        std::map<std::string, std::string> signatures;
+        std::map<std::string, AST::PrototypeAST *> prototypes;
+        std::map<std::string, int> precedences;
+
+        std::vector<TieredFunction> tieredFunctions;
+        std::mutex tieredMutex;
+        std::condition_variable tierUpSignal;
+        bool isStopping = false;
+        std::atomic<unsigned> promotedCount = 0;
+        std::thread tierUpThread;
+
+        static void optimizeModule(llvm::Module &module, llvm::TargetMachine *machine, llvm::OptimizationLevel level);
+        llvm::orc::ExecutorAddr lookupAddress(std::string name);
+        bool buildModule(std::string source);
+
+        std::vector<std::unique_ptr<llvm::Module>> extractDefinitions(std::string source, llvm::orc::ThreadSafeContext &context, bool isDeclared);
+        void addDefinitions(std::string source);
+
+        llvm::Error addTieredModule(llvm::orc::ThreadSafeModule module, const std::map<llvm::Function *, llvm::GlobalVariable *> &counters);
+        void tierUp();
+        bool stopRequested();
+        void promote(const TieredFunction &function);
+
+    public:
+        JitSession(JitMode mode = JitMode::Lazy);
+        ~JitSession();
+
+        JitSession &compile(std::string source);
+
+        /// Evaluates an expression against the functions an incremental session has
+        /// compiled so far. Returns false if it did not compile.
+        bool evaluate(std::string expression, double &result);
+
+        /// The address of the function 'name' as a 'Signature' pointer, or nullptr
+        /// if no compiled module defines it.
+        template <typename Signature>
+        Signature *lookup(std::string name)
+        {
+            return lookupAddress(name).toPtr<Signature *>();
+        }
+
+        bool getHadError();
+
+        /// The functions of a tiered session recompiled with the full pipeline so far.
+        unsigned getPromotedCount();
+    };
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+#include <dorset-lang/Driver/JitSession.h>
+
+namespace Dorset
+{
+    /// Repl - The interactive 'dorsetc --repl'. Definitions are compiled as they are
+    /// entered and other lines are evaluated as expressions, all on one incremental
+    /// JitSession, so nothing is written to disk or linked.
+    class Repl
+    {
+    private:
+        JitSession session;
+
+        bool isComplete(const std::string &entry);
+        bool isDefinition(const std::string &entry);
+        void evaluate(std::string entry, std::ostream &output);
+
+    public:
+        Repl();
+
+        int run(std::istream &input, std::ostream &output);
+    };
+}
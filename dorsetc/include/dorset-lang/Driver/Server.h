@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Dorset
+{
+    /// CompileServer - Keeps the compiler and its initialized targets resident, and
+    /// runs the compiles 'dorsetc --client' forwards over a Unix domain socket.
+    class CompileServer
+    {
+    private:
+        std::string socketPath;
+
+        void handle(int connection);
+
+    public:
+        CompileServer(std::string socketPath);
+
+        static std::string defaultSocketPath();
+
+        int run();
+    };
+
+    /// Runs a compile on the server listening at 'socketPath' from the current
+    /// directory and prints its output. Returns -1 if no server is listening.
+    int forwardToServer(std::string socketPath, std::vector<std::string> arguments);
+}
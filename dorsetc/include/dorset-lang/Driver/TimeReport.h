@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/Timer.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace Dorset
+{
+    /// TimeReport - Wall and CPU time of each compiler phase and optimization pass,
+    /// along with the sizes of what was compiled, for '--time-report'.
+    class TimeReport
+    {
+    private:
+        llvm::TimerGroup phases;
+        std::vector<std::unique_ptr<llvm::Timer>> timers;
+        llvm::TimePassesHandler passes;
+        std::vector<std::pair<std::string, uint64_t>> counts;
+
+    public:
+        TimeReport();
+
+        llvm::Timer *getPhase(std::string name, std::string description);
+        void registerPassTimers(llvm::PassInstrumentationCallbacks &PIC);
+        void addCount(std::string name, uint64_t value);
+
+        /// Peak resident set size of the process in kilobytes, 0 if unknown.
+        static uint64_t getPeakRSS();
+
+        void print(llvm::raw_ostream &OS);
+        void printJSON(llvm::raw_ostream &OS);
+    };
+
+    /// CompilerPhase - While in scope, times a phase in the report (if there is
+    /// one) and records it as a '-ftime-trace' event (if tracing is on).
+    class CompilerPhase
+    {
+    private:
+        llvm::TimeRegion region;
+        llvm::TimeTraceScope trace;
+
+    public:
+        CompilerPhase(TimeReport *report, std::string name, std::string description);
+    };
+}
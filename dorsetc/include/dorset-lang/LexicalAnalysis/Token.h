@@ -21,8 +21,8 @@ namespace Dorset
         IDENTIFIER, STRING, NUMBER,
 
         // Operators
-        PLUS, SLASH, STAR, FORWARD_SLASH, BACK_SLASH, VERTICAL_BAR, 
-        COLON, AMPERSAND, CARET, EXCLAMATION, LESS, GREATER, 
+        PLUS, MINUS, STAR, FORWARD_SLASH, BACK_SLASH, VERTICAL_BAR, 
+        COLON, AMPERSAND, CARET, EXCLAMATION, LESS, GREATER, PERCENT,
 
         // Operator Related
         BINARY, UNARY,
@@ -30,10 +30,10 @@ namespace Dorset
         // Keywords.
         AND, CLASS, ELSE, _FALSE, FUNCTION, FOR, IF, NIL, OR,
         RETURN, SUPER, THIS, _TRUE, VAR, WHILE, EXTERN,
-        THEN, _IN, 
+        THEN, _IN, EXPORT, IMPORT,
 
         // Types
-        TYPE_VOID, TYPE_DOUBLE,
+        TYPE_VOID, TYPE_DOUBLE, TYPE_BOOL,
 
         // Special
         _EOE, // End of expression
@@ -57,6 +57,8 @@ namespace Dorset
         {"var",    VAR},
         {"while",  WHILE},
         {"extern", EXTERN},
+        {"export", EXPORT},
+        {"import", IMPORT},
         {"then",   THEN},
         {"in",     _IN},
         {"binary", BINARY},
@@ -65,7 +67,8 @@ namespace Dorset
 
     static std::map<std::string, enum TokenType> types = {
         {"void",    TYPE_VOID},
-        {"double",  TYPE_DOUBLE}
+        {"double",  TYPE_DOUBLE},
+        {"bool",    TYPE_BOOL}
     };
 
     class Token 
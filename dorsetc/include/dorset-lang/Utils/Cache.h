@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Dorset
+{
+    /// CompilationCache - An on disk store of build outputs, content addressed by
+    /// a hash of everything that can change them (source, compiler version,
+    /// target and flags).
+    class CompilationCache
+    {
+    private:
+        std::string directory;
+
+        std::string entryPath(std::string key, std::string extension);
+        void commit(std::string temporary, std::string entry);
+
+    public:
+        CompilationCache(std::string directory);
+
+        static std::string defaultDirectory();
+        static std::string hash(std::vector<std::string> inputs);
+
+        bool contains(std::string key, std::string extension);
+        std::string getEntryPath(std::string key, std::string extension);
+        bool restore(std::string key, std::string extension, std::string destination);
+        void store(std::string key, std::string extension, std::string source);
+        void storeData(std::string key, std::string extension, std::string data);
+    };
+}
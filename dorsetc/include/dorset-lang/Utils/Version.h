@@ -7,4 +7,5 @@ using namespace semver;
 namespace Dorset
 {
     version getVersion();
+    std::string getCommitHash();
 }
@@ -36,9 +36,184 @@ namespace Dorset
             // return TmpB.CreateAlloca(Type::getDoubleTy(*MasterAST::TheContext), nullptr, VarName);
         }
 
+        /// Converts a bool to a double, 'true' becoming 1.0.
+        static Value *castToDouble(Value *V)
+        {
+            if (V->getType()->isIntegerTy(1))
+                return MasterAST::Builder->CreateUIToFP(V, Type::getDoubleTy(*MasterAST::TheContext), "booltmp");
+            return V;
+        }
+
+        /// Converts a double to a bool by comparing non-equal to 0.0.
+        static Value *castToBool(Value *V, const Twine &Name)
+        {
+            if (V->getType()->isDoubleTy())
+                return MasterAST::Builder->CreateFCmpONE(V, ConstantFP::get(*MasterAST::TheContext, APFloat(0.0)), Name);
+            return V;
+        }
+
+        /// Converts between bools and doubles where 'T' requires it.
+        static Value *castToType(Value *V, Type *T)
+        {
+            if (T->isIntegerTy(1))
+                return castToBool(V, "booltmp");
+            if (T->isDoubleTy())
+                return castToDouble(V);
+            return V;
+        }
+
+        static bool isComparisonOp(const std::string &Op)
+        {
+            return Op == "<" || Op == ">" || Op == "<=" || Op == ">=" || Op == "==" || Op == "!=";
+        }
+
+        /// Operators lowered straight to instructions, with no side effects.
+        static bool isBuiltinBinaryOp(const std::string &Op)
+        {
+            return Op == "+" || Op == "-" || Op == "*" || Op == "/" || Op == "%" ||
+                isComparisonOp(Op) || Op == "and" || Op == "or";
+        }
+
+        /// Emits an i1 comparison for a builtin comparison operator, or returns
+        /// null if 'Op' is not one.
+        static Value *emitComparison(const std::string &Op, Value *L, Value *R, const Twine &Name)
+        {
+            if (!isComparisonOp(Op))
+                return nullptr;
+
+            L = castToDouble(L);
+            R = castToDouble(R);
+
+            if (Op == "<")
+            {
+                return MasterAST::Builder->CreateFCmpULT(L, R, Name);
+            }
+            else if (Op == ">")
+            {
+                return MasterAST::Builder->CreateFCmpUGT(L, R, Name);
+            }
+            else if (Op == "<=")
+            {
+                return MasterAST::Builder->CreateFCmpULE(L, R, Name);
+            }
+            else if (Op == ">=")
+            {
+                return MasterAST::Builder->CreateFCmpUGE(L, R, Name);
+            }
+            else if (Op == "==")
+            {
+                return MasterAST::Builder->CreateFCmpOEQ(L, R, Name);
+            }
+            else
+            {
+                return MasterAST::Builder->CreateFCmpUNE(L, R, Name);
+            }
+        }
+
+        static const std::string ProfileCounterPrefix = "__dorset_profile.";
+
+        /// Counts the calls to and the cycles spent in a function, in a [2 x i64]
+        /// global which createProfileDump collects into the profile table.
+        static void instrumentFunction(Function *TheFunction, const std::string &Name)
+        {
+            IRBuilder<> &B = *MasterAST::Builder;
+            Type *CountersTy = ArrayType::get(B.getInt64Ty(), 2);
+            auto *Counters = new GlobalVariable(*MasterAST::TheModule, CountersTy, false, GlobalValue::InternalLinkage,
+                                                ConstantAggregateZero::get(CountersTy), ProfileCounterPrefix + Name);
+            Function *ReadCycles = Intrinsic::getDeclaration(MasterAST::TheModule, Intrinsic::readcyclecounter);
+
+            BasicBlock &Entry = TheFunction->getEntryBlock();
+            B.SetInsertPoint(&Entry, Entry.getFirstNonPHIOrDbgOrAlloca());
+            Value *Start = B.CreateCall(ReadCycles, {}, "prof.start");
+
+            for (BasicBlock &BB : *TheFunction)
+            {
+                auto *Ret = dyn_cast_or_null<ReturnInst>(BB.getTerminator());
+                if (!Ret)
+                    continue;
+
+                B.SetInsertPoint(Ret);
+                Value *End = B.CreateCall(ReadCycles, {}, "prof.end");
+
+                Value *CallsPtr = B.CreateConstInBoundsGEP2_32(CountersTy, Counters, 0, 0);
+                Value *Calls = B.CreateLoad(B.getInt64Ty(), CallsPtr, "prof.calls");
+                B.CreateStore(B.CreateAdd(Calls, B.getInt64(1)), CallsPtr);
+
+                Value *CyclesPtr = B.CreateConstInBoundsGEP2_32(CountersTy, Counters, 0, 1);
+                Value *Cycles = B.CreateLoad(B.getInt64Ty(), CyclesPtr, "prof.cycles");
+                B.CreateStore(B.CreateAdd(Cycles, B.CreateSub(End, Start)), CyclesPtr);
+            }
+        }
+
+        static const std::string CallCounterPrefix = "__dorset_calls.";
+
+        /// Atomically counts the calls to a function, for a tiered JitSession to
+        /// find the functions worth recompiling with the full pipeline.
+        static void countCalls(Function *TheFunction, const std::string &Name)
+        {
+            IRBuilder<> &B = *MasterAST::Builder;
+            auto *Counter = new GlobalVariable(*MasterAST::TheModule, B.getInt64Ty(), false, GlobalValue::InternalLinkage,
+                                               B.getInt64(0), CallCounterPrefix + Name);
+            Counter->setAlignment(Align(8));
+            B.CreateAtomicRMW(AtomicRMWInst::Add, Counter, B.getInt64(1), MaybeAlign(8), AtomicOrdering::Monotonic);
+            MasterAST::CallCounters[TheFunction] = Counter;
+        }
+
+        static DIType *getDebugType(Type *Ty)
+        {
+            if (Ty->isDoubleTy())
+                return MasterAST::DBuilder->createBasicType("double", 64, dwarf::DW_ATE_float);
+            if (Ty->isIntegerTy(1))
+                return MasterAST::DBuilder->createBasicType("bool", 8, dwarf::DW_ATE_boolean);
+            if (Ty->isIntegerTy(32))
+                return MasterAST::DBuilder->createBasicType("int", 32, dwarf::DW_ATE_signed);
+            if (Ty->isPointerTy())
+                return MasterAST::DBuilder->createPointerType(MasterAST::DBuilder->createBasicType("char", 8, dwarf::DW_ATE_signed_char), 64);
+
+            // void
+            return nullptr;
+        }
+
+        /// Describes a parameter (ArgNo from 1) or local variable living in 'Storage'.
+        static void declareVariable(AllocaInst *Storage, const std::string &Name, unsigned ArgNo, int Line, int Col)
+        {
+            DIScope *Scope = MasterAST::LexicalBlocks.back();
+            DIFile *Unit = MasterAST::TheCU->getFile();
+            DIType *Ty = getDebugType(Storage->getAllocatedType());
+
+            DILocalVariable *Var;
+            if (ArgNo > 0)
+                Var = MasterAST::DBuilder->createParameterVariable(Scope, Name, ArgNo, Unit, Line, Ty, true);
+            else
+                Var = MasterAST::DBuilder->createAutoVariable(Scope, Name, Unit, Line, Ty, true);
+
+            MasterAST::DBuilder->insertDeclare(Storage, Var, MasterAST::DBuilder->createExpression(),
+                                               DILocation::get(*MasterAST::TheContext, Line, Col, Scope),
+                                               MasterAST::Builder->GetInsertBlock());
+        }
+
 
         void MasterAST::initializeModule(const char *moduleName)
         {
+            // Drop everything a previous compile in this process left behind.
+            delete DBuilder;
+            DBuilder = nullptr;
+            TheCU = nullptr;
+            LexicalBlocks.clear();
+            CurLoc = SourceLocation();
+            delete Builder;
+            delete TheFPM;
+            delete TheModule;
+            delete TheContext;
+            NamedValues.clear();
+            Arrays.clear();
+            FunctionProtos.clear();
+            BinopPrecedence = BuiltinBinopPrecedence;
+            NodeCount = 0;
+            InstrumentFunctions = false;
+            CountCalls = false;
+            CallCounters.clear();
+
             TheContext = new LLVMContext;
             TheModule = new Module(moduleName, *TheContext);
 
@@ -59,6 +234,89 @@ namespace Dorset
             Builder = new IRBuilder<>(*TheContext);
         }
 
+        std::pair<std::unique_ptr<LLVMContext>, std::unique_ptr<Module>> MasterAST::releaseModule()
+        {
+            // The module outlives the compile, so only the state that refers to it is dropped.
+            delete DBuilder;
+            DBuilder = nullptr;
+            TheCU = nullptr;
+            delete Builder;
+            Builder = nullptr;
+            delete TheFPM;
+            TheFPM = nullptr;
+            NamedValues.clear();
+            Arrays.clear();
+
+            std::unique_ptr<LLVMContext> context(TheContext);
+            std::unique_ptr<Module> module(TheModule);
+            TheContext = nullptr;
+            TheModule = nullptr;
+            return {std::move(context), std::move(module)};
+        }
+
+        void MasterAST::initializeDebugInfo(const std::string &fileName, const std::string &directory)
+        {
+            TheModule->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+            TheModule->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+
+            DBuilder = new DIBuilder(*TheModule);
+
+            // There is no DWARF language code for Dorset, C is the closest.
+            TheCU = DBuilder->createCompileUnit(dwarf::DW_LANG_C, DBuilder->createFile(fileName, directory),
+                                                "dorsetc", true, "", 0);
+        }
+
+        void MasterAST::finalizeDebugInfo()
+        {
+            if (DBuilder)
+                DBuilder->finalize();
+        }
+
+        void MasterAST::emitLocation(ExprAST *AST)
+        {
+            if (!DBuilder || LexicalBlocks.empty())
+                return;
+
+            if (!AST)
+            {
+                Builder->SetCurrentDebugLocation(DebugLoc());
+                return;
+            }
+
+            DIScope *Scope = LexicalBlocks.back();
+            Builder->SetCurrentDebugLocation(DILocation::get(Scope->getContext(), AST->getLine(), AST->getCol(), Scope));
+        }
+
+        ExprAST::ExprAST()
+            : Loc(MasterAST::CurLoc)
+        {
+            MasterAST::NodeCount++;
+        }
+
+        int ExprAST::getLine() const
+        {
+            return Loc.Line;
+        }
+
+        int ExprAST::getCol() const
+        {
+            return Loc.Col;
+        }
+
+        void ExprAST::setLocation(SourceLocation NewLoc)
+        {
+            Loc = NewLoc;
+        }
+
+        void ExprAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+        }
+
+        bool ExprAST::isLoopInvariant(const std::set<std::string> &Assigned)
+        {
+            return false;
+        }
+
         NumberExprAST::NumberExprAST(double Val) : Val(Val)
         {
         }
@@ -68,6 +326,25 @@ namespace Dorset
             return ConstantFP::get(*MasterAST::TheContext, APFloat(Val));
         }
 
+        bool NumberExprAST::isLoopInvariant(const std::set<std::string> &Assigned)
+        {
+            return true;
+        }
+
+        BoolExprAST::BoolExprAST(bool Val) : Val(Val)
+        {
+        }
+
+        Value *BoolExprAST::codegen()
+        {
+            return ConstantInt::getBool(*MasterAST::TheContext, Val);
+        }
+
+        bool BoolExprAST::isLoopInvariant(const std::set<std::string> &Assigned)
+        {
+            return true;
+        }
+
         StringExprAST::StringExprAST(std::string Val) : Val(Val)
         {
         }
@@ -90,15 +367,27 @@ namespace Dorset
 
         Value *VariableExprAST::codegen()
         {
+            MasterAST::emitLocation(this);
+
             // Look this variable up in the function.
-            AllocaInst *A = MasterAST::NamedValues[Name];
-            if (!A)
+            Value *V = MasterAST::NamedValues[Name];
+            if (!V)
                 return logError("unknown variable name: " + Name);
 
+            // Loop induction variables are bound directly to their SSA value.
+            AllocaInst *A = dyn_cast<AllocaInst>(V);
+            if (!A)
+                return V;
+
             // Load the value.
             return MasterAST::Builder->CreateLoad(A->getAllocatedType(), A, Name.c_str());
         }
 
+        bool VariableExprAST::isLoopInvariant(const std::set<std::string> &Assigned)
+        {
+            return Assigned.count(Name) == 0;
+        }
+
         const std::string &VariableExprAST::getName()
         {
             return Name;
@@ -129,7 +418,11 @@ namespace Dorset
             }
 
 
-            AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Name, Type::getDoubleTy(*MasterAST::TheContext));
+            // The variable takes the type of its initializer, either bool or double.
+            AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Name, InitVal->getType());
+            MasterAST::emitLocation(this);
+            if (MasterAST::DBuilder)
+                declareVariable(Alloca, Name, 0, getLine(), getCol());
             MasterAST::Builder->CreateStore(InitVal, Alloca);
 
             // Remember this binding.
@@ -139,6 +432,15 @@ namespace Dorset
             return InitVal;
         }
 
+        void VarExprAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+            Names.insert(Name);
+            if (Init != nullptr)
+            {
+                Init->collectAssignedNames(Names);
+            }
+        }
+
         ArrayExprAST::ArrayExprAST(std::string Name, ExprAST* SizeExpr, std::vector<ExprAST*> Values)
             : Name(Name), SizeExpr(SizeExpr), Values(Values)
         {       
@@ -146,7 +448,8 @@ namespace Dorset
 
         Value* ArrayExprAST::codegen()
         {
-            Size = SizeExpr->codegen();
+            MasterAST::emitLocation(this);
+            Size = castToDouble(SizeExpr->codegen());
 
             Value *uintResult = MasterAST::Builder->CreateFPToUI(Size, Type::getInt32Ty(*MasterAST::TheContext));
 
@@ -161,7 +464,7 @@ namespace Dorset
                 // Access the dynamically calculated element of the array
                 Value* elementPtr = MasterAST::Builder->CreateGEP(Type::getDoubleTy(*MasterAST::TheContext), getArray(), uintResult);
 
-                Value* Val = Values[i]->codegen();
+                Value* Val = castToDouble(Values[i]->codegen());
 
                 // Store the modified value back to the array
                 MasterAST::Builder->CreateStore(Val, elementPtr);
@@ -172,6 +475,16 @@ namespace Dorset
             return Array;
         }
 
+        void ArrayExprAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+            Names.insert(Name);
+            SizeExpr->collectAssignedNames(Names);
+            for (unsigned int i = 0; i < Values.size(); i++)
+            {
+                Values[i]->collectAssignedNames(Names);
+            }
+        }
+
         Value *ArrayExprAST::getSize()
         {
             return Size;
@@ -189,6 +502,7 @@ namespace Dorset
 
         Value *ArrayElementRefExprAST::codegen()
         {
+            MasterAST::emitLocation(this);
             ArrayExprAST *WorkingArray = MasterAST::Arrays[ArrayName];
 
             Value *uintResult = MasterAST::Builder->CreateFPToUI(getIndex(), Type::getInt32Ty(*MasterAST::TheContext));
@@ -202,6 +516,11 @@ namespace Dorset
             return loadedValue;
         }
 
+        void ArrayElementRefExprAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+            Index->collectAssignedNames(Names);
+        }
+
         const std::string& ArrayElementRefExprAST::getName()
         {
             return ArrayName;
@@ -209,7 +528,7 @@ namespace Dorset
 
         Value *ArrayElementRefExprAST::getIndex()
         {
-            return Index->codegen();
+            return castToDouble(Index->codegen());
         }
 
         BinaryExprAST::BinaryExprAST(std::string Op, ExprAST *LHS, ExprAST *RHS)
@@ -219,6 +538,8 @@ namespace Dorset
 
         Value *BinaryExprAST::codegen()
         {
+            MasterAST::emitLocation(this);
+
             if (Op == "=")
             {
                 bool isArray = false;
@@ -244,6 +565,7 @@ namespace Dorset
                     {
                         return logError("'right hand side' generation failed for variable: " + LHS_ArrayRef->getName());
                     }
+                    Val = castToDouble(Val);
 
                     // Look up the name.
                     ArrayExprAST *WorkingArray = MasterAST::Arrays[LHS_ArrayRef->getName()];
@@ -287,18 +609,47 @@ namespace Dorset
                         return logError("unknown variable name: " + LHS_Variable->getName());
                     }
 
-                    MasterAST::Builder->CreateStore(Val, Variable);
+                    AllocaInst *Alloca = dyn_cast<AllocaInst>(Variable);
+                    if (!Alloca)
+                    {
+                        return logError("cannot assign to loop variable: " + LHS_Variable->getName());
+                    }
+
+                    // A variable keeps the type of its initializer, and a number is never
+                    // silently turned into a bool by comparing it against 0.
+                    if (Alloca->getAllocatedType()->isIntegerTy(1) && Val->getType()->isDoubleTy())
+                    {
+                        return logError("cannot assign a number to the bool variable " + LHS_Variable->getName() + ", compare it instead");
+                    }
+
+                    Val = castToType(Val, Alloca->getAllocatedType());
+                    MasterAST::Builder->CreateStore(Val, Alloca);
 
                     return Val;
                 }
             }
 
+            if (Op == "and" || Op == "or")
+            {
+                return codegenShortCircuit();
+            }
+
             Value *L = LHS->codegen();
             Value *R = RHS->codegen();
             if (!L || !R)
             {
                 return logError("left or right hand side generations has failed for some expression");
             }
+            MasterAST::emitLocation(this);
+
+            // Comparisons stay as i1, everything else works on doubles.
+            if (Value *Cmp = emitComparison(Op, L, R, "cmptmp"))
+            {
+                return Cmp;
+            }
+
+            L = castToDouble(L);
+            R = castToDouble(R);
 
             if (Op == "+")
             {
@@ -312,17 +663,13 @@ namespace Dorset
             {
                 return MasterAST::Builder->CreateFMul(L, R, "multmp");
             }
-            else if (Op == "<")
+            else if (Op == "/")
             {
-                L = MasterAST::Builder->CreateFCmpULT(L, R, "fcmptmp");
-                // Convert bool 0/1 to double 0.0 or 1.0
-                return MasterAST::Builder->CreateUIToFP(L, Type::getDoubleTy(*MasterAST::TheContext), "booltmp");
+                return MasterAST::Builder->CreateFDiv(L, R, "divtmp");
             }
-            else if (Op == "==")
+            else if (Op == "%")
             {
-                L = MasterAST::Builder->CreateFCmpOEQ(L, R, "fcmptmp");
-                // Convert bool 0/1 to double 0.0 or 1.0
-                return MasterAST::Builder->CreateUIToFP(L, Type::getDoubleTy(*MasterAST::TheContext), "booltmp");
+                return MasterAST::Builder->CreateFRem(L, R, "remtmp");
             }
 
             // If it wasn't a builtin binary operator, it must be a user defined one. Emit
@@ -334,6 +681,90 @@ namespace Dorset
             return MasterAST::Builder->CreateCall(F, Ops, "binop");
         }
 
+        Value *BinaryExprAST::codegenShortCircuit()
+        {
+            bool IsAnd = Op == "and";
+
+            Value *L = LHS->codegen();
+            if (!L)
+            {
+                return logError("left hand side generation has failed for '" + Op + "'");
+            }
+            L = castToBool(L, "lhsbool");
+
+            Function *TheFunction = MasterAST::Builder->GetInsertBlock()->getParent();
+            BasicBlock *LHSBB = MasterAST::Builder->GetInsertBlock();
+            BasicBlock *RHSBB = BasicBlock::Create(*MasterAST::TheContext, IsAnd ? "and.rhs" : "or.rhs", TheFunction);
+            BasicBlock *MergeBB = BasicBlock::Create(*MasterAST::TheContext, IsAnd ? "and.end" : "or.end");
+
+            // Only evaluate the right hand side if the left does not decide the result.
+            if (IsAnd)
+                MasterAST::Builder->CreateCondBr(L, RHSBB, MergeBB);
+            else
+                MasterAST::Builder->CreateCondBr(L, MergeBB, RHSBB);
+
+            MasterAST::Builder->SetInsertPoint(RHSBB);
+            Value *R = RHS->codegen();
+            if (!R)
+            {
+                return logError("right hand side generation has failed for '" + Op + "'");
+            }
+            R = castToBool(R, "rhsbool");
+            MasterAST::Builder->CreateBr(MergeBB);
+            // Codegen of 'RHS' can change the current block, update RHSBB for the PHI.
+            RHSBB = MasterAST::Builder->GetInsertBlock();
+
+            TheFunction->insert(TheFunction->end(), MergeBB);
+            MasterAST::Builder->SetInsertPoint(MergeBB);
+
+            PHINode *PN = MasterAST::Builder->CreatePHI(Type::getInt1Ty(*MasterAST::TheContext), 2, IsAnd ? "andtmp" : "ortmp");
+            PN->addIncoming(ConstantInt::getBool(*MasterAST::TheContext, !IsAnd), LHSBB);
+            PN->addIncoming(R, RHSBB);
+            return PN;
+        }
+
+        void BinaryExprAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+            if (Op == "=")
+            {
+                if (VariableExprAST *LHS_Variable = dynamic_cast<VariableExprAST *>(LHS))
+                {
+                    Names.insert(LHS_Variable->getName());
+                }
+                else if (ArrayElementRefExprAST *LHS_ArrayRef = dynamic_cast<ArrayElementRefExprAST *>(LHS))
+                {
+                    Names.insert(LHS_ArrayRef->getName());
+                }
+            }
+
+            LHS->collectAssignedNames(Names);
+            RHS->collectAssignedNames(Names);
+        }
+
+        bool BinaryExprAST::isLoopInvariant(const std::set<std::string> &Assigned)
+        {
+            // User defined operators are calls and may have side effects.
+            if (!isBuiltinBinaryOp(Op))
+                return false;
+
+            return LHS->isLoopInvariant(Assigned) && RHS->isLoopInvariant(Assigned);
+        }
+
+        const std::string &BinaryExprAST::getOp()
+        {
+            return Op;
+        }
+
+        ExprAST *BinaryExprAST::getLHS()
+        {
+            return LHS;
+        }
+
+        ExprAST *BinaryExprAST::getRHS()
+        {
+            return RHS;
+        }
+
         CallExprAST::CallExprAST(const std::string &Callee, std::vector<ExprAST *> Args)
             : Callee(Callee), Args(Args)
         {
@@ -353,10 +784,19 @@ namespace Dorset
             std::vector<Value *> ArgsV;
             for (unsigned i = 0, e = Args.size(); i != e; ++i)
             {
-                ArgsV.push_back(Args[i]->codegen());
-                if (!ArgsV.back())
+                Value *ArgV = Args[i]->codegen();
+                if (!ArgV)
                     return nullptr;
+
+                // Varargs (printf) are passed bools as doubles.
+                if (i < CalleeF->getFunctionType()->getNumParams())
+                    ArgV = castToType(ArgV, CalleeF->getFunctionType()->getParamType(i));
+                else
+                    ArgV = castToDouble(ArgV);
+
+                ArgsV.push_back(ArgV);
             }
+            MasterAST::emitLocation(this);
 
             if (CalleeF->getReturnType() == Type::getVoidTy(*MasterAST::TheContext))
                 return MasterAST::Builder->CreateCall(CalleeF, ArgsV, "");
@@ -364,6 +804,14 @@ namespace Dorset
                 return MasterAST::Builder->CreateCall(CalleeF, ArgsV, "calltmp");
         }
 
+        void CallExprAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+            for (unsigned i = 0, e = Args.size(); i != e; ++i)
+            {
+                Args[i]->collectAssignedNames(Names);
+            }
+        }
+
         PrototypeArgumentAST::PrototypeArgumentAST(std::string Name, std::string ArgType)
             : Name(Name)
         {
@@ -371,6 +819,10 @@ namespace Dorset
             {
                 this->ArgType = MasterAST::Builder->getDoubleTy();
             }
+            else if (ArgType == "bool")
+            {
+                this->ArgType = MasterAST::Builder->getInt1Ty();
+            }
             else if (ArgType == "string")
             {
                 this->ArgType = MasterAST::Builder->getInt8Ty()->getPointerTo();
@@ -393,8 +845,10 @@ namespace Dorset
         }
 
         PrototypeAST::PrototypeAST(const std::string& Name, std::vector<PrototypeArgumentAST*> Args, std::string ReturnType, bool IsOperator, unsigned Prec)
-            : Name(Name), Args(std::move(Args)), IsOperator(IsOperator), Precedence(Prec), ReturnType(ReturnType)
+            : Name(Name), Args(std::move(Args)), IsOperator(IsOperator), Precedence(Prec), ReturnType(ReturnType),
+              Line(MasterAST::CurLoc.Line)
         {
+            MasterAST::NodeCount++;
         }
 
         const std::string &PrototypeAST::getName() const
@@ -407,6 +861,16 @@ namespace Dorset
             return ReturnType;
         }
 
+        const std::vector<PrototypeArgumentAST*> &PrototypeAST::getArgs() const
+        {
+            return Args;
+        }
+
+        int PrototypeAST::getLine() const
+        {
+            return Line;
+        }
+
         Function *PrototypeAST::codegen()
         {
             // Make the function type:  double(double,double) etc.
@@ -428,11 +892,22 @@ namespace Dorset
             {
                 type = Type::getDoubleTy(*MasterAST::TheContext);
             }
+            else if (ReturnType == "bool")
+            {
+                type = Type::getInt1Ty(*MasterAST::TheContext);
+            }
             else
             {
                 type = Type::getVoidTy(*MasterAST::TheContext);
             }
 
+            // The C runtime takes the exit status from main, so it returns 0 in an
+            // int rather than leaving the status to whatever is left in the register.
+            if (Name == "main")
+            {
+                type = Type::getInt32Ty(*MasterAST::TheContext);
+            }
+
             FunctionType* FT = FunctionType::get(type, ArgsTypes, false);
             Function* F = Function::Create(FT, Function::ExternalLinkage, Name, MasterAST::TheModule);
 
@@ -456,6 +931,16 @@ namespace Dorset
             return IsOperator && Args.size() == 2;
         }
 
+        bool PrototypeAST::isExported() const
+        {
+            return IsExported;
+        }
+
+        void PrototypeAST::setExported()
+        {
+            IsExported = true;
+        }
+
         std::string PrototypeAST::getOperatorName() const
         {
             assert(isUnaryOp() || isBinaryOp());
@@ -472,6 +957,12 @@ namespace Dorset
         FunctionAST::FunctionAST(PrototypeAST *Proto, BlockAST *Body)
             : Proto(std::move(Proto)), Body(Body)
         {
+            MasterAST::NodeCount++;
+        }
+
+        PrototypeAST *FunctionAST::getProto()
+        {
+            return Proto;
         }
 
         Function *FunctionAST::codegen()
@@ -479,6 +970,7 @@ namespace Dorset
             // Transfer ownership of the prototype to the FunctionProtos map, but keep a
             // reference to it for use below.
             auto &P = *Proto;
+            TimeTraceScope trace("FunctionAST::codegen", P.getName());
             MasterAST::FunctionProtos[Proto->getName()] = std::move(Proto);
             Function *TheFunction = getFunction(P.getName());
             if (!TheFunction)
@@ -487,21 +979,66 @@ namespace Dorset
                 return nullptr;
             }
 
+            // Builtin operators are lowered directly and never call a user definition.
+            if ((P.isBinaryOp() && isBuiltinBinaryOp(P.getOperatorName())) || (P.isUnaryOp() && P.getOperatorName() == "-"))
+                ErrorHandler::warning("operator '" + P.getOperatorName() + "' is builtin, this definition is never called");
+
             // If this is an operator, install it.
             if (P.isBinaryOp())
                 MasterAST::BinopPrecedence[P.getOperatorName()] = P.getBinaryPrecedence();
 
+            // Only 'main' and exported functions are visible outside the module, the
+            // rest can be specialized or dropped by the optimizer.
+            if (P.getName() != "main" && !P.isExported())
+                TheFunction->setLinkage(Function::InternalLinkage);
+
+            // Operators are small and called everywhere, have the always inliner
+            // fold them into their callers.
+            if (P.isUnaryOp() || P.isBinaryOp())
+                TheFunction->addFnAttr(Attribute::AlwaysInline);
+
             // Create a new basic block to start insertion into.
             BasicBlock *BB = BasicBlock::Create(*MasterAST::TheContext, "entry", TheFunction);
             MasterAST::Builder->SetInsertPoint(BB);
 
+            if (MasterAST::CountCalls)
+                countCalls(TheFunction, P.getName());
+
+            // Give the function a subprogram for its line table.
+            if (MasterAST::DBuilder)
+            {
+                DIFile *Unit = MasterAST::TheCU->getFile();
+                SmallVector<Metadata *, 8> Types;
+                Types.push_back(getDebugType(TheFunction->getReturnType()));
+                for (auto &Arg : TheFunction->args())
+                    Types.push_back(getDebugType(Arg.getType()));
+
+                DISubprogram::DISPFlags Flags = DISubprogram::SPFlagDefinition;
+                if (TheFunction->hasLocalLinkage())
+                    Flags |= DISubprogram::SPFlagLocalToUnit;
+
+                DISubprogram *SP = MasterAST::DBuilder->createFunction(
+                    Unit, P.getName(), StringRef(), Unit, P.getLine(),
+                    MasterAST::DBuilder->createSubroutineType(MasterAST::DBuilder->getOrCreateTypeArray(Types)),
+                    P.getLine(), DINode::FlagPrototyped, Flags);
+                TheFunction->setSubprogram(SP);
+                MasterAST::LexicalBlocks.push_back(SP);
+
+                // The prologue has no location.
+                MasterAST::emitLocation(nullptr);
+            }
+
             // Record the function arguments in the NamedValues map.
             MasterAST::NamedValues.clear();
             MasterAST::Arrays.clear();
+            unsigned ArgNo = 0;
             for (auto &Arg : TheFunction->args())
             {
                 // Create an alloca for this variable.
-                AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Arg.getName().str(), Type::getDoubleTy(*MasterAST::TheContext));
+                AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Arg.getName().str(), Arg.getType());
+
+                if (MasterAST::DBuilder)
+                    declareVariable(Alloca, Arg.getName().str(), ++ArgNo, P.getLine(), 0);
 
                 // Store the initial value into the alloca.
                 MasterAST::Builder->CreateStore(&Arg, Alloca);
@@ -510,7 +1047,12 @@ namespace Dorset
                 MasterAST::NamedValues[std::string(Arg.getName())] = Alloca;
             }
 
-            if (Body->codegen() == nullptr)
+            MasterAST::emitLocation(Body);
+            Value *BodyVal = Body->codegen();
+            if (MasterAST::DBuilder)
+                MasterAST::LexicalBlocks.pop_back();
+
+            if (BodyVal == nullptr)
             {
                 ErrorHandler::error("block generation has failed for function: " + P.getName());
                 return nullptr;
@@ -518,7 +1060,12 @@ namespace Dorset
 
             if (P.getReturnType() == "void") 
             {
-                MasterAST::Builder->CreateRet(nullptr);
+                MasterAST::Builder->CreateRet(P.getName() == "main" ? MasterAST::Builder->getInt32(0) : nullptr);
+            }
+
+            if (MasterAST::InstrumentFunctions)
+            {
+                instrumentFunction(TheFunction, P.getName());
             }
 
             // Validate the generated code, checking for consistency.
@@ -534,6 +1081,8 @@ namespace Dorset
 
         Value *IfExprAST::codegen()
         {
+            MasterAST::emitLocation(this);
+
             bool NeedsIfCont = true;
             if (ThenReturns && ElseReturns)
             {
@@ -544,9 +1093,8 @@ namespace Dorset
             if (!CondV)
                 return nullptr;
 
-            // Convert condition to a bool by comparing non-equal to 0.0.
-            CondV = MasterAST::Builder->CreateFCmpONE(
-                CondV, ConstantFP::get(*MasterAST::TheContext, APFloat(0.0)), "ifcond");
+            // Conditions that are already bools are branched on directly.
+            CondV = castToBool(CondV, "ifcond");
 
             Function *TheFunction = MasterAST::Builder->GetInsertBlock()->getParent();
 
@@ -601,6 +1149,16 @@ namespace Dorset
             return Constant::getNullValue(Type::getDoubleTy(*MasterAST::TheContext));
         }
 
+        void IfExprAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+            Cond->collectAssignedNames(Names);
+            Then->collectAssignedNames(Names);
+            if (Else)
+            {
+                Else->collectAssignedNames(Names);
+            }
+        }
+
         ForExprAST::ForExprAST(const std::string &VarName, ExprAST *Start, ExprAST *End, ExprAST *Step, ExprAST *Body)
             : VarName(VarName), Start(std::move(Start)), End(std::move(End)),
             Step(std::move(Step)), Body(std::move(Body))
@@ -609,33 +1167,132 @@ namespace Dorset
 
         Value *ForExprAST::codegen()
         {
-            Function *TheFunction = MasterAST::Builder->GetInsertBlock()->getParent();
+            MasterAST::emitLocation(this);
 
-            // Create an alloca for the variable in the entry block.
-            AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName, Type::getDoubleTy(*MasterAST::TheContext));
+            Function *TheFunction = MasterAST::Builder->GetInsertBlock()->getParent();
 
             // Emit the start code first, without 'variable' in scope.
             Value *StartVal = Start->codegen();
             if (!StartVal)
                 return nullptr;
+            StartVal = castToDouble(StartVal);
+
+            // Find everything the loop writes to. An induction variable that the loop
+            // never assigns lives in a PHI node, otherwise it keeps an alloca so the
+            // body can mutate it.
+            std::set<std::string> Assigned;
+            Body->collectAssignedNames(Assigned);
+            End->collectAssignedNames(Assigned);
+            if (Step)
+                Step->collectAssignedNames(Assigned);
 
-            // Store the value into the alloca.
-            MasterAST::Builder->CreateStore(StartVal, Alloca);
+            AllocaInst *Alloca = nullptr;
+            if (Assigned.count(VarName))
+                Alloca = CreateEntryBlockAlloca(TheFunction, VarName, Type::getDoubleTy(*MasterAST::TheContext));
 
-            // Make the new basic block for the loop header, inserting after current
-            // block.
-            BasicBlock *LoopBB = BasicBlock::Create(*MasterAST::TheContext, "loop", TheFunction);
+            Assigned.insert(VarName);
 
-            // Insert an explicit fall through from the current block to the LoopBB.
-            MasterAST::Builder->CreateBr(LoopBB);
+            // Emit the step value in the preheader when it is invariant, it is
+            // re-evaluated in the latch otherwise.
+            Value *StepVal = nullptr;
+            if (!Step)
+            {
+                // If not specified, use 1.0.
+                StepVal = ConstantFP::get(*MasterAST::TheContext, APFloat(1.0));
+            }
+            else if (Step->isLoopInvariant(Assigned))
+            {
+                StepVal = Step->codegen();
+                if (!StepVal)
+                    return nullptr;
+                StepVal = castToDouble(StepVal);
+            }
 
-            // Start insertion in LoopBB.
-            MasterAST::Builder->SetInsertPoint(LoopBB);
+            // If the end condition compares the variable against an invariant bound,
+            // evaluate the bound once here and only emit the compare in the loop.
+            BinaryExprAST *EndCmp = dynamic_cast<BinaryExprAST *>(End);
+            Value *Bound = nullptr;
+            bool BoundOnLeft = false;
+            if (EndCmp && isComparisonOp(EndCmp->getOp()))
+            {
+                VariableExprAST *CmpLHS = dynamic_cast<VariableExprAST *>(EndCmp->getLHS());
+                VariableExprAST *CmpRHS = dynamic_cast<VariableExprAST *>(EndCmp->getRHS());
+
+                if (CmpLHS && CmpLHS->getName() == VarName && EndCmp->getRHS()->isLoopInvariant(Assigned))
+                {
+                    Bound = EndCmp->getRHS()->codegen();
+                    if (!Bound)
+                        return nullptr;
+                }
+                else if (CmpRHS && CmpRHS->getName() == VarName && EndCmp->getLHS()->isLoopInvariant(Assigned))
+                {
+                    Bound = EndCmp->getLHS()->codegen();
+                    if (!Bound)
+                        return nullptr;
+                    BoundOnLeft = true;
+                }
+            }
 
             // Within the loop, the variable is defined equal to the PHI node.  If it
             // shadows an existing variable, we have to restore it, so save it now.
-            AllocaInst *OldVal = MasterAST::NamedValues[VarName];
-            MasterAST::NamedValues[VarName] = Alloca;
+            Value *OldVal = MasterAST::NamedValues[VarName];
+
+            auto bindVariable = [&](Value *Val)
+            {
+                if (Alloca)
+                {
+                    MasterAST::Builder->CreateStore(Val, Alloca);
+                    MasterAST::NamedValues[VarName] = Alloca;
+                }
+                else
+                {
+                    MasterAST::NamedValues[VarName] = Val;
+                }
+            };
+
+            auto emitEndCond = [&](Value *Val) -> Value *
+            {
+                if (Bound)
+                {
+                    if (BoundOnLeft)
+                        return emitComparison(EndCmp->getOp(), Bound, Val, "loopcond");
+                    return emitComparison(EndCmp->getOp(), Val, Bound, "loopcond");
+                }
+
+                Value *EndCond = End->codegen();
+                if (!EndCond)
+                    return nullptr;
+
+                return castToBool(EndCond, "loopcond");
+            };
+
+            // Guard the loop so the body never runs if the condition fails up front.
+            bindVariable(StartVal);
+            Value *GuardCond = emitEndCond(StartVal);
+            if (!GuardCond)
+                return nullptr;
+
+            BasicBlock *PreheaderBB = BasicBlock::Create(*MasterAST::TheContext, "loop.preheader", TheFunction);
+            BasicBlock *LoopBB = BasicBlock::Create(*MasterAST::TheContext, "loop");
+            BasicBlock *LatchBB = BasicBlock::Create(*MasterAST::TheContext, "loop.latch");
+            BasicBlock *AfterBB = BasicBlock::Create(*MasterAST::TheContext, "afterloop");
+
+            MasterAST::Builder->CreateCondBr(GuardCond, PreheaderBB, AfterBB);
+
+            MasterAST::Builder->SetInsertPoint(PreheaderBB);
+            MasterAST::Builder->CreateBr(LoopBB);
+
+            // Start insertion in LoopBB, the loop header.
+            TheFunction->insert(TheFunction->end(), LoopBB);
+            MasterAST::Builder->SetInsertPoint(LoopBB);
+
+            PHINode *Variable = nullptr;
+            if (!Alloca)
+            {
+                Variable = MasterAST::Builder->CreatePHI(Type::getDoubleTy(*MasterAST::TheContext), 2, VarName);
+                Variable->addIncoming(StartVal, PreheaderBB);
+                bindVariable(Variable);
+            }
 
             // Emit the body of the loop.  This, like any other expr, can change the
             // current BB.  Note that we ignore the value computed by the body, but don't
@@ -643,44 +1300,42 @@ namespace Dorset
             if (!Body->codegen())
                 return nullptr;
 
-            // Emit the step value.
-            Value *StepVal = nullptr;
-            if (Step)
+            // A body that always returns has already terminated its block.
+            if (!MasterAST::Builder->GetInsertBlock()->getTerminator())
+                MasterAST::Builder->CreateBr(LatchBB);
+
+            TheFunction->insert(TheFunction->end(), LatchBB);
+            MasterAST::Builder->SetInsertPoint(LatchBB);
+
+            if (!StepVal)
             {
                 StepVal = Step->codegen();
                 if (!StepVal)
                     return nullptr;
-            }
-            else
-            {
-                // If not specified, use 1.0.
-                StepVal = ConstantFP::get(*MasterAST::TheContext, APFloat(1.0));
+                StepVal = castToDouble(StepVal);
             }
 
-            // Compute the end condition.
-            Value *EndCond = End->codegen();
-            if (!EndCond)
-                return nullptr;
+            // Reload the alloca if the loop can mutate the variable.
+            Value *CurVar = Variable;
+            if (Alloca)
+                CurVar = MasterAST::Builder->CreateLoad(Alloca->getAllocatedType(), Alloca, VarName.c_str());
 
-            // Reload, increment, and restore the alloca.  This handles the case where
-            // the body of the loop mutates the variable.
-            Value *CurVar =
-                MasterAST::Builder->CreateLoad(Alloca->getAllocatedType(), Alloca, VarName.c_str());
             Value *NextVar = MasterAST::Builder->CreateFAdd(CurVar, StepVal, "nextvar");
-            MasterAST::Builder->CreateStore(NextVar, Alloca);
+            bindVariable(NextVar);
 
-            // Convert condition to a bool by comparing non-equal to 0.0.
-            EndCond = MasterAST::Builder->CreateFCmpONE(
-                EndCond, ConstantFP::get(*MasterAST::TheContext, APFloat(0.0)), "loopcond");
-
-            // Create the "after loop" block and insert it.
-            BasicBlock *AfterBB =
-                BasicBlock::Create(*MasterAST::TheContext, "afterloop", TheFunction);
+            // Test the stepped variable, so together with the guard the condition
+            // holds on every iteration the body runs.
+            Value *EndCond = emitEndCond(NextVar);
+            if (!EndCond)
+                return nullptr;
 
-            // Insert the conditional branch into the end of LoopEndBB.
+            // Insert the conditional branch into the end of the latch.
             MasterAST::Builder->CreateCondBr(EndCond, LoopBB, AfterBB);
+            if (Variable)
+                Variable->addIncoming(NextVar, MasterAST::Builder->GetInsertBlock());
 
             // Any new code will be inserted in AfterBB.
+            TheFunction->insert(TheFunction->end(), AfterBB);
             MasterAST::Builder->SetInsertPoint(AfterBB);
 
             // Restore the unshadowed variable.
@@ -693,6 +1348,16 @@ namespace Dorset
             return Constant::getNullValue(Type::getDoubleTy(*MasterAST::TheContext));
         }
 
+        void ForExprAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+            Names.insert(VarName);
+            Start->collectAssignedNames(Names);
+            End->collectAssignedNames(Names);
+            if (Step)
+                Step->collectAssignedNames(Names);
+            Body->collectAssignedNames(Names);
+        }
+
         UnaryExprAST::UnaryExprAST(char Opcode, ExprAST *Operand)
             : Opcode(Opcode), Operand(std::move(Operand))
         {
@@ -703,14 +1368,30 @@ namespace Dorset
             Value *OperandV = Operand->codegen();
             if (!OperandV)
                 return nullptr;
+            MasterAST::emitLocation(this);
+
+            if (Opcode == '-')
+                return MasterAST::Builder->CreateFNeg(castToDouble(OperandV), "negtmp");
 
             Function *F = getFunction(std::string("unary") + Opcode);
             if (!F)
                 return logError("unknown unary operator");
 
+            OperandV = castToType(OperandV, F->getFunctionType()->getParamType(0));
             return MasterAST::Builder->CreateCall(F, OperandV, "unop");
         }
 
+        void UnaryExprAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+            Operand->collectAssignedNames(Names);
+        }
+
+        bool UnaryExprAST::isLoopInvariant(const std::set<std::string> &Assigned)
+        {
+            // Only negation is builtin, other unary operators are calls.
+            return Opcode == '-' && Operand->isLoopInvariant(Assigned);
+        }
+
         ReturnExprAST::ReturnExprAST(ExprAST* Expr)
             : Expr(Expr)
         {
@@ -720,6 +1401,7 @@ namespace Dorset
         Value* ReturnExprAST::codegen()
         {
             Value* RetVal = nullptr;
+            Function *TheFunction = MasterAST::Builder->GetInsertBlock()->getParent();
 
             if (Expr != nullptr) 
             {
@@ -728,12 +1410,31 @@ namespace Dorset
                 {
                     return logError("return value failed");
                 }
+
+                RetVal = castToType(RetVal, TheFunction->getReturnType());
+            }
+
+            MasterAST::emitLocation(this);
+
+            // What main returns is evaluated, but the program always exits with 0.
+            if (TheFunction->getName() == "main")
+            {
+                MasterAST::Builder->CreateRet(MasterAST::Builder->getInt32(0));
+                return RetVal;
             }
 
             MasterAST::Builder->CreateRet(RetVal);
             return RetVal;
         }
 
+        void ReturnExprAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+            if (Expr != nullptr)
+            {
+                Expr->collectAssignedNames(Names);
+            }
+        }
+
         BlockAST::BlockAST(std::vector<ExprAST*> Exprs) 
             : Exprs(Exprs)
         {
@@ -752,6 +1453,14 @@ namespace Dorset
             return Constant::getNullValue(Type::getDoubleTy(*MasterAST::TheContext));
         }
 
+        void BlockAST::collectAssignedNames(std::set<std::string> &Names)
+        {
+            for (unsigned int i = 0; i < Exprs.size(); i++)
+            {
+                Exprs[i]->collectAssignedNames(Names);
+            }
+        }
+
         void createExternalFunctions()
         {
             auto bytePtrTy = MasterAST::Builder->getInt8Ty()->getPointerTo();
@@ -792,6 +1501,7 @@ namespace Dorset
             auto& P = *proto;
             MasterAST::FunctionProtos[proto->getName()] = std::move(proto);
             Function* TheFunction = getFunction(P.getName());
+            TheFunction->setLinkage(Function::InternalLinkage);
 
             BasicBlock* BB = BasicBlock::Create(*MasterAST::TheContext, "entry", TheFunction);
             MasterAST::Builder->SetInsertPoint(BB);
@@ -813,5 +1523,146 @@ namespace Dorset
 
             verifyFunction(*TheFunction);
         }
+
+        void createProfileDump()
+        {
+            IRBuilder<> &B = *MasterAST::Builder;
+            Module &M = *MasterAST::TheModule;
+            B.SetCurrentDebugLocation(DebugLoc());
+            auto bytePtrTy = B.getInt8Ty()->getPointerTo();
+            auto int64Ty = B.getInt64Ty();
+
+            // One row of name and counters for every function instrumentFunction saw.
+            StructType *RowTy = StructType::get(*MasterAST::TheContext, {bytePtrTy, bytePtrTy});
+            std::vector<Constant*> Rows;
+            for (GlobalVariable &G : M.globals())
+            {
+                if (!G.getName().starts_with(ProfileCounterPrefix))
+                    continue;
+
+                std::string Name = G.getName().substr(ProfileCounterPrefix.size()).str();
+                Constant *NameStr = B.CreateGlobalString(Name, "", 0, &M);
+                Rows.push_back(ConstantStruct::get(RowTy, {NameStr, &G}));
+            }
+
+            ArrayType *TableTy = ArrayType::get(RowTy, Rows.size());
+            auto *Table = new GlobalVariable(M, TableTy, true, GlobalValue::InternalLinkage,
+                                             ConstantArray::get(TableTy, Rows), "__dorset_profile_table");
+
+            // Every module of the program links its table into one list, so a single dump
+            // covers them all, whether they are linked as objects or with -flto. The list
+            // head and the flag for the one atexit registration are shared weak globals.
+            StructType *NodeTy = StructType::get(*MasterAST::TheContext, {bytePtrTy, int64Ty, bytePtrTy});
+            auto *Node = new GlobalVariable(M, NodeTy, false, GlobalValue::InternalLinkage,
+                                            ConstantStruct::get(NodeTy, {Table, B.getInt64(Rows.size()), ConstantPointerNull::get(bytePtrTy)}),
+                                            "__dorset_profile_module");
+            auto *Head = M.getGlobalVariable("__dorset_profile_modules");
+            if (!Head)
+                Head = new GlobalVariable(M, bytePtrTy, false, GlobalValue::WeakAnyLinkage,
+                                          ConstantPointerNull::get(bytePtrTy), "__dorset_profile_modules");
+            auto *Registered = M.getGlobalVariable("__dorset_profile_registered");
+            if (!Registered)
+                Registered = new GlobalVariable(M, B.getInt8Ty(), false, GlobalValue::WeakAnyLinkage,
+                                                B.getInt8(0), "__dorset_profile_registered");
+
+            FunctionCallee Getenv = M.getOrInsertFunction("getenv", bytePtrTy, bytePtrTy);
+            FunctionCallee Fopen = M.getOrInsertFunction("fopen", bytePtrTy, bytePtrTy, bytePtrTy);
+            FunctionCallee Fclose = M.getOrInsertFunction("fclose", B.getInt32Ty(), bytePtrTy);
+            FunctionCallee Fprintf = M.getOrInsertFunction("fprintf",
+                                                           FunctionType::get(B.getInt32Ty(), {bytePtrTy, bytePtrTy}, true));
+            FunctionCallee Atexit = M.getOrInsertFunction("atexit", B.getInt32Ty(), B.getVoidTy()->getPointerTo());
+
+            // __dorset_profile_dump writes the flat profile of every module to $DORSET_PROFILE, or dorset.prof.
+            Function *Dump = Function::Create(FunctionType::get(B.getVoidTy(), false), GlobalValue::InternalLinkage,
+                                              "__dorset_profile_dump", M);
+            BasicBlock *Entry = BasicBlock::Create(*MasterAST::TheContext, "entry", Dump);
+            BasicBlock *Open = BasicBlock::Create(*MasterAST::TheContext, "open", Dump);
+            BasicBlock *NextModule = BasicBlock::Create(*MasterAST::TheContext, "module", Dump);
+            BasicBlock *ModuleBody = BasicBlock::Create(*MasterAST::TheContext, "module.body", Dump);
+            BasicBlock *Loop = BasicBlock::Create(*MasterAST::TheContext, "loop", Dump);
+            BasicBlock *ModuleDone = BasicBlock::Create(*MasterAST::TheContext, "module.done", Dump);
+            BasicBlock *Done = BasicBlock::Create(*MasterAST::TheContext, "done", Dump);
+            BasicBlock *Exit = BasicBlock::Create(*MasterAST::TheContext, "exit", Dump);
+
+            B.SetInsertPoint(Entry);
+            Value *EnvPath = B.CreateCall(Getenv, {B.CreateGlobalString("DORSET_PROFILE", "", 0, &M)});
+            Value *Path = B.CreateSelect(B.CreateIsNull(EnvPath), B.CreateGlobalString("dorset.prof", "", 0, &M), EnvPath);
+            Value *File = B.CreateCall(Fopen, {Path, B.CreateGlobalString("w", "", 0, &M)});
+            B.CreateCondBr(B.CreateIsNull(File), Exit, Open);
+
+            B.SetInsertPoint(Open);
+            B.CreateCall(Fprintf, {File, B.CreateGlobalString("%-32s %12s %16s %14s\n", "", 0, &M),
+                                   B.CreateGlobalString("function", "", 0, &M), B.CreateGlobalString("calls", "", 0, &M),
+                                   B.CreateGlobalString("cycles", "", 0, &M), B.CreateGlobalString("cycles/call", "", 0, &M)});
+            Value *First = B.CreateLoad(bytePtrTy, Head, "first");
+            B.CreateBr(NextModule);
+
+            B.SetInsertPoint(NextModule);
+            PHINode *Current = B.CreatePHI(bytePtrTy, 2, "node");
+            Current->addIncoming(First, Open);
+            B.CreateCondBr(B.CreateIsNull(Current), Done, ModuleBody);
+
+            B.SetInsertPoint(ModuleBody);
+            Value *ModuleRows = B.CreateLoad(bytePtrTy, B.CreateStructGEP(NodeTy, Current, 0), "rows");
+            Value *Count = B.CreateLoad(int64Ty, B.CreateStructGEP(NodeTy, Current, 1), "count");
+            B.CreateCondBr(B.CreateICmpEQ(Count, B.getInt64(0)), ModuleDone, Loop);
+
+            B.SetInsertPoint(Loop);
+            PHINode *Index = B.CreatePHI(int64Ty, 2, "i");
+            Index->addIncoming(B.getInt64(0), ModuleBody);
+
+            Value *Name = B.CreateLoad(bytePtrTy, B.CreateInBoundsGEP(RowTy, ModuleRows, {Index, B.getInt32(0)}));
+            Value *Counters = B.CreateLoad(bytePtrTy, B.CreateInBoundsGEP(RowTy, ModuleRows, {Index, B.getInt32(1)}));
+            Value *Calls = B.CreateLoad(int64Ty, Counters, "calls");
+            Value *Cycles = B.CreateLoad(int64Ty, B.CreateConstInBoundsGEP1_64(int64Ty, Counters, 1), "cycles");
+
+            Value *Divisor = B.CreateSelect(B.CreateICmpEQ(Calls, B.getInt64(0)), B.getInt64(1), Calls);
+            Value *PerCall = B.CreateFDiv(B.CreateUIToFP(Cycles, B.getDoubleTy()), B.CreateUIToFP(Divisor, B.getDoubleTy()));
+            B.CreateCall(Fprintf, {File, B.CreateGlobalString("%-32s %12llu %16llu %14.1f\n", "", 0, &M),
+                                   Name, Calls, Cycles, PerCall});
+
+            Value *Next = B.CreateAdd(Index, B.getInt64(1));
+            Index->addIncoming(Next, Loop);
+            B.CreateCondBr(B.CreateICmpULT(Next, Count), Loop, ModuleDone);
+
+            B.SetInsertPoint(ModuleDone);
+            Value *Following = B.CreateLoad(bytePtrTy, B.CreateStructGEP(NodeTy, Current, 2), "next");
+            Current->addIncoming(Following, ModuleDone);
+            B.CreateBr(NextModule);
+
+            B.SetInsertPoint(Done);
+            B.CreateCall(Fclose, {File});
+            B.CreateBr(Exit);
+
+            B.SetInsertPoint(Exit);
+            B.CreateRetVoid();
+            verifyFunction(*Dump);
+
+            // A constructor links the table in, and the first one to run registers its dump
+            // with atexit, so the counters are final when it runs and the profile file is
+            // only written once.
+            Function *Init = Function::Create(FunctionType::get(B.getVoidTy(), false), GlobalValue::InternalLinkage,
+                                              "__dorset_profile_init", M);
+            BasicBlock *InitEntry = BasicBlock::Create(*MasterAST::TheContext, "entry", Init);
+            BasicBlock *Register = BasicBlock::Create(*MasterAST::TheContext, "register", Init);
+            BasicBlock *InitExit = BasicBlock::Create(*MasterAST::TheContext, "exit", Init);
+
+            B.SetInsertPoint(InitEntry);
+            B.CreateStore(B.CreateLoad(bytePtrTy, Head), B.CreateStructGEP(NodeTy, Node, 2));
+            B.CreateStore(Node, Head);
+            Value *IsRegistered = B.CreateLoad(B.getInt8Ty(), Registered);
+            B.CreateCondBr(B.CreateICmpNE(IsRegistered, B.getInt8(0)), InitExit, Register);
+
+            B.SetInsertPoint(Register);
+            B.CreateStore(B.getInt8(1), Registered);
+            B.CreateCall(Atexit, {Dump});
+            B.CreateBr(InitExit);
+
+            B.SetInsertPoint(InitExit);
+            B.CreateRetVoid();
+            verifyFunction(*Init);
+
+            appendToGlobalCtors(M, Init, 65535);
+        }
     }
 }
\ No newline at end of file
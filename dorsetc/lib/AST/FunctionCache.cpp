@@ -0,0 +1,192 @@
+#include <dorset-lang/AST/FunctionCache.h>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+namespace Dorset
+{
+    namespace AST
+    {
+        FunctionCache::FunctionCache(std::string directory, std::string baseKey) : cache{CompilationCache(directory)}, baseKey{baseKey}
+        {
+        }
+
+        std::string FunctionCache::computeKey(std::string source, const std::set<std::string> &names)
+        {
+            // A function's IR depends on its own tokens, the signatures of the functions
+            // and user operators it calls, and the precedences of the operators it uses.
+            // Nothing else in the file, so editing one function keeps the others' entries.
+            std::vector<std::string> inputs = { baseKey, source };
+
+            for (auto &name : names)
+            {
+                for (std::string callee : { name, "binary" + name, "unary" + name })
+                {
+                    if (Function *F = MasterAST::TheModule->getFunction(callee))
+                    {
+                        std::string signature;
+                        raw_string_ostream stream(signature);
+                        stream << F->getName() << " " << *F->getFunctionType();
+                        inputs.push_back(stream.str());
+                    }
+                }
+
+                auto Binop = MasterAST::BinopPrecedence.find(name);
+                if (Binop != MasterAST::BinopPrecedence.end() && Binop->second > 0)
+                {
+                    inputs.push_back(Binop->first + " " + std::to_string(Binop->second));
+                }
+            }
+
+            return CompilationCache::hash(inputs);
+        }
+
+        bool FunctionCache::reuse(std::string key, PrototypeAST *Proto)
+        {
+            if (!cache.contains(key, ".bc"))
+            {
+                return false;
+            }
+
+            // Register the prototype as codegen would, the body is linked in later.
+            MasterAST::FunctionProtos[Proto->getName()] = Proto;
+            if (Proto->isBinaryOp())
+                MasterAST::BinopPrecedence[Proto->getOperatorName()] = Proto->getBinaryPrecedence();
+
+            // Declare it so callers and the keys of later functions see the same module.
+            if (!getFunction(Proto->getName()))
+            {
+                return false;
+            }
+
+            pending.push_back({key, Proto->getName(), Proto->getName() != "main" && !Proto->isExported()});
+            return true;
+        }
+
+        void FunctionCache::store(std::string key, Function *F)
+        {
+            std::unique_ptr<Module> M = extractFunction(F);
+
+            std::string bitcode;
+            raw_string_ostream stream(bitcode);
+            WriteBitcodeToFile(*M, stream);
+            stream.flush();
+
+            cache.storeData(key, ".bc", bitcode);
+        }
+
+        std::unique_ptr<Module> FunctionCache::extractFunction(Function *F)
+        {
+            auto M = std::make_unique<Module>(F->getName(), *MasterAST::TheContext);
+            ValueToValueMapTy VMap;
+
+            // Declare every function and copy every global the body refers to.
+            std::function<void(Value *)> mapOperand = [&](Value *V)
+            {
+                if (VMap.count(V))
+                {
+                    return;
+                }
+
+                if (auto *Callee = dyn_cast<Function>(V))
+                {
+                    Function *Decl = Function::Create(Callee->getFunctionType(), Function::ExternalLinkage, Callee->getName(), M.get());
+                    Decl->copyAttributesFrom(Callee);
+                    Decl->setLinkage(Function::ExternalLinkage);
+                    VMap[Callee] = Decl;
+                }
+                else if (auto *GV = dyn_cast<GlobalVariable>(V))
+                {
+                    auto *Copy = new GlobalVariable(*M, GV->getValueType(), GV->isConstant(), GV->getLinkage(), GV->hasInitializer() ? GV->getInitializer() : nullptr, GV->getName());
+                    Copy->copyAttributesFrom(GV);
+                    VMap[GV] = Copy;
+                }
+                else if (auto *CE = dyn_cast<ConstantExpr>(V))
+                {
+                    for (Value *Op : CE->operands())
+                        mapOperand(Op);
+                }
+            };
+
+            Function *Clone = Function::Create(F->getFunctionType(), Function::ExternalLinkage, F->getName(), M.get());
+            VMap[F] = Clone;
+
+            for (Instruction &I : instructions(F))
+                for (Value *Op : I.operands())
+                    mapOperand(Op);
+
+            auto CloneArg = Clone->arg_begin();
+            for (Argument &Arg : F->args())
+            {
+                CloneArg->setName(Arg.getName());
+                VMap[&Arg] = &*CloneArg++;
+            }
+
+            SmallVector<ReturnInst *, 8> Returns;
+            CloneFunctionInto(Clone, F, VMap, CloneFunctionChangeType::DifferentModule, Returns);
+
+            // Stored with external linkage so the linker resolves it against the
+            // declarations its callers made, linkCachedFunctions restores the rest.
+            Clone->setLinkage(Function::ExternalLinkage);
+            return M;
+        }
+
+        bool FunctionCache::linkCachedFunctions()
+        {
+            // The linker never resolves references against internal symbols, so
+            // expose the module's definitions while the cached bodies go in.
+            std::vector<std::string> internal;
+            for (Function &F : *MasterAST::TheModule)
+            {
+                if (F.hasInternalLinkage())
+                {
+                    internal.push_back(F.getName().str());
+                    F.setLinkage(Function::ExternalLinkage);
+                }
+            }
+
+            for (auto &entry : pending)
+            {
+                auto buffer = MemoryBuffer::getFile(cache.getEntryPath(entry.Key, ".bc"));
+                if (!buffer)
+                {
+                    ErrorHandler::error("could not read the cached function: " + entry.Name);
+                    return false;
+                }
+
+                auto M = parseBitcodeFile((*buffer)->getMemBufferRef(), *MasterAST::TheContext);
+                if (!M)
+                {
+                    consumeError(M.takeError());
+                    ErrorHandler::error("could not parse the cached function: " + entry.Name);
+                    return false;
+                }
+
+                if (Linker::linkModules(*MasterAST::TheModule, std::move(*M)))
+                {
+                    ErrorHandler::error("could not link the cached function: " + entry.Name);
+                    return false;
+                }
+
+                if (entry.IsInternal)
+                {
+                    internal.push_back(entry.Name);
+                }
+            }
+            pending.clear();
+
+            for (auto &name : internal)
+            {
+                if (Function *F = MasterAST::TheModule->getFunction(name))
+                {
+                    F->setLinkage(Function::InternalLinkage);
+                }
+            }
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,289 @@
+#include <dorset-lang/AST/ModuleInterface.h>
+#include <dorset-lang/AST/FunctionCache.h>
+
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+namespace Dorset
+{
+    namespace AST
+    {
+        static const char InterfaceMagic[] = "DSI1";
+
+        // Bodies up to this many instructions are offered to importers for inlining.
+        static const unsigned InlinableInstructionLimit = 64;
+
+        // Everything is stored as little endian 32 bit integers and length prefixed strings.
+        static void writeInt(raw_ostream &OS, uint32_t Value)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                OS << (char)((Value >> (8 * i)) & 0xff);
+            }
+        }
+
+        static void writeString(raw_ostream &OS, StringRef Value)
+        {
+            writeInt(OS, Value.size());
+            OS << Value;
+        }
+
+        static bool readInt(StringRef &Data, uint32_t &Value)
+        {
+            if (Data.size() < 4)
+            {
+                return false;
+            }
+
+            Value = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                Value |= (uint32_t)(unsigned char)Data[i] << (8 * i);
+            }
+            Data = Data.drop_front(4);
+            return true;
+        }
+
+        static bool readString(StringRef &Data, StringRef &Value)
+        {
+            uint32_t Size;
+            if (!readInt(Data, Size) || Data.size() < Size)
+            {
+                return false;
+            }
+
+            Value = Data.take_front(Size);
+            Data = Data.drop_front(Size);
+            return true;
+        }
+
+        static std::string getTypeName(Type *Ty)
+        {
+            if (Ty->isIntegerTy(1))
+                return "bool";
+            if (Ty->isPointerTy())
+                return "string";
+            return "double";
+        }
+
+        static bool isInlinable(Function &F)
+        {
+            if (F.isDeclaration() || F.getInstructionCount() > InlinableInstructionLimit)
+            {
+                return false;
+            }
+
+            // Internal functions and mutable globals do not exist in the importing module.
+            for (Instruction &I : instructions(F))
+            {
+                for (Value *Op : I.operands())
+                {
+                    if (auto *Callee = dyn_cast<Function>(Op))
+                    {
+                        if (Callee->hasLocalLinkage())
+                            return false;
+                    }
+                    else if (auto *GV = dyn_cast<GlobalVariable>(Op))
+                    {
+                        if (!GV->isConstant())
+                            return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        ModuleInterface::ModuleInterface()
+        {
+        }
+
+        ModuleInterface::ModuleInterface(std::string sourceHash, std::vector<PrototypeAST*> prototypes)
+            : sourceHash(sourceHash), prototypes(prototypes)
+        {
+        }
+
+        std::string ModuleInterface::getInterfacePath(std::string sourcePath)
+        {
+            size_t extension = sourcePath.find_last_of(".");
+            if (extension == std::string::npos || sourcePath.find_last_of("/\\") > extension)
+            {
+                return sourcePath + ".dsi";
+            }
+            return sourcePath.substr(0, extension) + ".dsi";
+        }
+
+        const std::string &ModuleInterface::getSourceHash() const
+        {
+            return sourceHash;
+        }
+
+        void ModuleInterface::addBodies()
+        {
+            auto Bodies = std::make_unique<Module>("interface", *MasterAST::TheContext);
+            bool HasBodies = false;
+
+            for (PrototypeAST *Proto : prototypes)
+            {
+                Function *F = MasterAST::TheModule->getFunction(Proto->getName());
+                if (!F || !isInlinable(*F))
+                {
+                    continue;
+                }
+
+                // Line tables belong to the file's own object, not to its importers.
+                std::unique_ptr<Module> M = FunctionCache::extractFunction(F);
+                StripDebugInfo(*M);
+                if (Linker::linkModules(*Bodies, std::move(M)))
+                {
+                    return;
+                }
+                HasBodies = true;
+            }
+
+            if (!HasBodies)
+            {
+                return;
+            }
+
+            std::string data;
+            raw_string_ostream stream(data);
+            WriteBitcodeToFile(*Bodies, stream);
+            stream.flush();
+
+            buffer = MemoryBuffer::getMemBufferCopy(data, "interface");
+            bitcode = buffer->getBuffer();
+        }
+
+        bool ModuleInterface::read(std::string path)
+        {
+            // Mapped rather than copied, the bitcode is parsed straight from the file.
+            auto file = MemoryBuffer::getFile(path);
+            if (!file)
+            {
+                return false;
+            }
+            buffer = std::move(*file);
+
+            StringRef Data = buffer->getBuffer();
+            if (!Data.starts_with(InterfaceMagic))
+            {
+                return false;
+            }
+            Data = Data.drop_front(sizeof(InterfaceMagic) - 1);
+
+            StringRef Hash;
+            uint32_t Count;
+            if (!readString(Data, Hash) || !readInt(Data, Count))
+            {
+                return false;
+            }
+            sourceHash = Hash.str();
+
+            prototypes.clear();
+            for (uint32_t i = 0; i < Count; i++)
+            {
+                StringRef Name, ReturnType;
+                uint32_t IsOperator, Precedence, ArgCount;
+                if (!readString(Data, Name) || !readString(Data, ReturnType) || !readInt(Data, IsOperator) ||
+                    !readInt(Data, Precedence) || !readInt(Data, ArgCount))
+                {
+                    return false;
+                }
+
+                std::vector<PrototypeArgumentAST*> Args;
+                for (uint32_t j = 0; j < ArgCount; j++)
+                {
+                    StringRef ArgName, ArgType;
+                    if (!readString(Data, ArgName) || !readString(Data, ArgType))
+                    {
+                        return false;
+                    }
+                    Args.push_back(new PrototypeArgumentAST(ArgName.str(), ArgType.str()));
+                }
+
+                prototypes.push_back(new PrototypeAST(Name.str(), Args, ReturnType.str(), IsOperator != 0, Precedence));
+            }
+
+            return readString(Data, bitcode);
+        }
+
+        bool ModuleInterface::write(std::string path)
+        {
+            std::error_code EC;
+            raw_fd_ostream file(path, EC, sys::fs::OF_None);
+            if (EC)
+            {
+                return false;
+            }
+
+            file << InterfaceMagic;
+            writeString(file, sourceHash);
+            writeInt(file, prototypes.size());
+            for (PrototypeAST *Proto : prototypes)
+            {
+                writeString(file, Proto->getName());
+                writeString(file, Proto->getReturnType());
+                writeInt(file, Proto->isUnaryOp() || Proto->isBinaryOp());
+                writeInt(file, Proto->getBinaryPrecedence());
+                writeInt(file, Proto->getArgs().size());
+                for (PrototypeArgumentAST *Arg : Proto->getArgs())
+                {
+                    writeString(file, Arg->getName());
+                    writeString(file, getTypeName(Arg->getType()));
+                }
+            }
+            writeString(file, bitcode);
+
+            file.close();
+            return !file.has_error();
+        }
+
+        bool ModuleInterface::import()
+        {
+            for (PrototypeAST *Proto : prototypes)
+            {
+                // Operators need their precedence before the importer's expressions are parsed.
+                if (Proto->isBinaryOp())
+                    MasterAST::BinopPrecedence[Proto->getOperatorName()] = Proto->getBinaryPrecedence();
+
+                if (MasterAST::TheModule->getFunction(Proto->getName()))
+                {
+                    continue;
+                }
+
+                MasterAST::FunctionProtos[Proto->getName()] = Proto;
+                if (!Proto->codegen())
+                {
+                    return false;
+                }
+            }
+
+            if (bitcode.empty())
+            {
+                return true;
+            }
+
+            auto M = parseBitcodeFile(MemoryBufferRef(bitcode, "interface"), *MasterAST::TheContext);
+            if (!M)
+            {
+                consumeError(M.takeError());
+                ErrorHandler::warning("could not read the function bodies of an interface, only its declarations are imported");
+                return true;
+            }
+
+            // The definitions stay in the imported file's object. These copies are only
+            // there to be inlined, like the user defined operators always are.
+            for (Function &F : **M)
+            {
+                if (!F.isDeclaration())
+                {
+                    F.setLinkage(GlobalValue::AvailableExternallyLinkage);
+                    F.addFnAttr(Attribute::AlwaysInline);
+                }
+            }
+
+            return !Linker::linkModules(*MasterAST::TheModule, std::move(*M));
+        }
+    }
+}
@@ -1,11 +1,20 @@
 #include <dorset-lang/Builder/ASTBuilder.h>
+#include <dorset-lang/AST/ModuleInterface.h>
+#include <dorset-lang/LexicalAnalysis/Lexer.h>
+#include <dorset-lang/Utils/Cache.h>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 
 namespace Dorset
 {
-    ASTBuilder::ASTBuilder(std::vector<Token> tokens)
+    ASTBuilder::ASTBuilder(std::vector<Token> tokens, AST::FunctionCache *functionCache, std::string directory)
     {
         this->tokens = tokens;
         this->currentTokenIndex = 0;
+        this->functionCache = functionCache;
+        this->directory = directory;
     }
 
     Token ASTBuilder::currentToken()
@@ -15,6 +24,9 @@ namespace Dorset
             ErrorHandler::error("overshot token list length in source root, this can be caused by a miriad of issues");
             exit(1);
         }
+
+        // New AST nodes take the location of the last token read.
+        AST::MasterAST::CurLoc = {tokens[currentTokenIndex].getLine(), tokens[currentTokenIndex].getCharacter()};
         return tokens[currentTokenIndex];
     }
 
@@ -40,6 +52,20 @@ namespace Dorset
             {
                 handleExtern();
             }
+            else if (currentToken().getType() == IMPORT)
+            {
+                handleImport();
+            }
+            else if (currentToken().getType() == EXPORT)
+            {
+                advanceToken(); // eat export.
+                if (currentToken().getType() != FUNCTION)
+                {
+                    ErrorHandler::error("expected function definition after 'export'", currentToken().getLine(), currentToken().getCharacter());
+                    continue;
+                }
+                handleDefinition(true);
+            }
             else
             {
                 ErrorHandler::error("unexpected token at 'top level'", currentToken().getLine(), currentToken().getCharacter());
@@ -47,7 +73,7 @@ namespace Dorset
                 while (cond)
                 {
                     advanceToken();
-                    if (currentToken().getType() == _EOF || currentToken().getType() == FUNCTION || currentToken().getType() == EXTERN)
+                    if (currentToken().getType() == _EOF || currentToken().getType() == FUNCTION || currentToken().getType() == EXTERN || currentToken().getType() == EXPORT || currentToken().getType() == IMPORT)
                     {
                         cond = false;
                     }
@@ -84,6 +110,7 @@ namespace Dorset
 
     AST::ExprAST *ASTBuilder::parseIfExpression(bool& hasReturn)
     {
+        AST::SourceLocation IfLoc = AST::MasterAST::CurLoc;
         advanceToken();  // eat the if.
 
         // condition.
@@ -150,11 +177,14 @@ namespace Dorset
             hasReturn = true;
         }
 
-        return new AST::IfExprAST(std::move(Cond), std::move(Then), std::move(Else), thenReturns, elseReturns);
+        AST::ExprAST *If = new AST::IfExprAST(std::move(Cond), std::move(Then), std::move(Else), thenReturns, elseReturns);
+        If->setLocation(IfLoc);
+        return If;
     }
 
     AST::ExprAST *ASTBuilder::parseForExpression(bool& hasReturn)
     {
+        AST::SourceLocation ForLoc = AST::MasterAST::CurLoc;
         advanceToken();  // eat the for.
 
         if (currentToken().getType() != LEFT_PAREN)
@@ -258,7 +288,9 @@ namespace Dorset
             return nullptr;
         }
 
-        return new AST::ForExprAST(IdName, std::move(Start), std::move(End), std::move(Step), std::move(Body));
+        AST::ExprAST *For = new AST::ForExprAST(IdName, std::move(Start), std::move(End), std::move(Step), std::move(Body));
+        For->setLocation(ForLoc);
+        return For;
     }
 
     AST::PrototypeAST *ASTBuilder::parsePrototype()
@@ -346,7 +378,7 @@ namespace Dorset
         advanceToken(); // eat ')'.
 
         std::string returnType;
-        if (currentToken().getType() == TYPE_VOID || currentToken().getType() == TYPE_DOUBLE) 
+        if (currentToken().getType() == TYPE_VOID || currentToken().getType() == TYPE_DOUBLE || currentToken().getType() == TYPE_BOOL) 
         {
             returnType = currentToken().getLexeme();
         }
@@ -419,7 +451,7 @@ namespace Dorset
     }
 
 
-    AST::FunctionAST *ASTBuilder::parseDefinition()
+    AST::FunctionAST *ASTBuilder::parseDefinition(bool isExported)
     {
         advanceToken(); // eat def.
         auto Proto = parsePrototype();
@@ -428,6 +460,11 @@ namespace Dorset
             return nullptr;
         }
 
+        if (isExported)
+        {
+            Proto->setExported();
+        }
+
         needsReturnToken = true;
         if (Proto->getReturnType() == "void")
             needsReturnToken = false;
@@ -469,12 +506,65 @@ namespace Dorset
         return Proto;
     }
 
-    void ASTBuilder::handleDefinition()
+    std::string ASTBuilder::getTokenSource(int start, int end)
     {
-        if (auto FnAST = parseDefinition())
+        // Positions are left out, so moving a function does not invalidate it.
+        std::string source;
+        for (int i = start; i < end; i++)
         {
+            source += tokens[i].getTypeStr() + " " + tokens[i].getLexeme() + " " + tokens[i].getLiteral() + "\n";
+        }
+        return source;
+    }
+
+    std::set<std::string> ASTBuilder::getTokenNames(int start, int end)
+    {
+        std::set<std::string> names;
+        for (int i = start; i < end; i++)
+        {
+            names.insert(tokens[i].getLexeme());
+        }
+        return names;
+    }
+
+    std::string ASTBuilder::peekDefinitionName()
+    {
+        // The name follows 'fn' or 'extern', operators add their symbol.
+        if (currentTokenIndex + 1 >= tokens.size())
+        {
+            return "";
+        }
+
+        std::string name = tokens[currentTokenIndex + 1].getLexeme();
+        if ((name == "binary" || name == "unary") && currentTokenIndex + 2 < tokens.size())
+        {
+            name += tokens[currentTokenIndex + 2].getLexeme();
+        }
+        return name;
+    }
+
+    void ASTBuilder::handleDefinition(bool isExported)
+    {
+        TimeTraceScope trace("handleDefinition", [&]() { return peekDefinitionName(); });
+        int startTokenIndex = currentTokenIndex;
+        if (auto FnAST = parseDefinition(isExported))
+        {
+            std::string cacheKey;
+            if (functionCache)
+            {
+                cacheKey = functionCache->computeKey(getTokenSource(startTokenIndex, currentTokenIndex), getTokenNames(startTokenIndex, currentTokenIndex));
+                if (functionCache->reuse(cacheKey, FnAST->getProto()))
+                {
+                    return;
+                }
+            }
+
             if (auto *FnIR = FnAST->codegen())
             {
+                if (functionCache && !ErrorHandler::HadError)
+                {
+                    functionCache->store(cacheKey, FnIR);
+                }
             }
             else
             {
@@ -491,10 +581,13 @@ namespace Dorset
 
     void ASTBuilder::handleExtern()
     {
+        TimeTraceScope trace("handleExtern", [&]() { return peekDefinitionName(); });
         if (auto ProtoAST = parseExtern())
         {
             if (auto *FnIR = ProtoAST->codegen())
             {
+                // Kept like a definition's, so the declaration can be emitted again.
+                AST::MasterAST::FunctionProtos[ProtoAST->getName()] = ProtoAST;
             }
             else
             {
@@ -508,4 +601,83 @@ namespace Dorset
                 advanceToken();
         }
     }
+
+    void ASTBuilder::handleImport()
+    {
+        advanceToken(); // eat import.
+        if (currentToken().getType() != STRING)
+        {
+            ErrorHandler::error("expected a file name after 'import'", currentToken().getLine(), currentToken().getCharacter());
+            advanceToken();
+            return;
+        }
+
+        // Imports are relative to the importing file.
+        std::filesystem::path path = currentToken().getLiteral();
+        if (path.is_relative() && directory != "")
+        {
+            path = std::filesystem::path(directory) / path;
+        }
+        std::string location = std::filesystem::absolute(path).lexically_normal().generic_string();
+        int line = currentToken().getLine();
+
+        advanceToken();
+        if (currentToken().getType() != SEMICOLON)
+        {
+            ErrorHandler::error("no terminating semicolon", currentToken().getLine());
+            return;
+        }
+        advanceToken();
+
+        if (!imported.insert(location).second)
+        {
+            return;
+        }
+
+        TimeTraceScope trace("handleImport", location);
+        std::ifstream file(location);
+        if (!file)
+        {
+            ErrorHandler::error("could not open imported file: " + location, line);
+            return;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+
+        // Without an up to date interface file, find the exported prototypes in the source.
+        AST::ModuleInterface interface;
+        std::string sourceHash = CompilationCache::hash({contents.str()});
+        if (!interface.read(AST::ModuleInterface::getInterfacePath(location)) || interface.getSourceHash() != sourceHash)
+        {
+            Lexer lexer = Lexer(contents.str());
+            ASTBuilder library = ASTBuilder(lexer.scanTokens());
+            interface = AST::ModuleInterface(sourceHash, library.parseExportedPrototypes());
+        }
+
+        if (!interface.import())
+        {
+            ErrorHandler::error("could not import " + location, line);
+        }
+    }
+
+    std::vector<AST::PrototypeAST*> ASTBuilder::parseExportedPrototypes()
+    {
+        // Function bodies never contain 'export', so there is no need to parse them.
+        std::vector<AST::PrototypeAST*> prototypes;
+        while (currentToken().getType() != _EOF)
+        {
+            if (currentToken().getType() == EXPORT && tokens[currentTokenIndex + 1].getType() == FUNCTION)
+            {
+                advanceToken(); // eat export.
+                advanceToken(); // eat fn.
+                if (auto *Proto = parsePrototype())
+                {
+                    prototypes.push_back(Proto);
+                }
+                continue;
+            }
+            advanceToken();
+        }
+        return prototypes;
+    }
 }
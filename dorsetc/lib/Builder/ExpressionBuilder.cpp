@@ -16,6 +16,9 @@ namespace Dorset
             ErrorHandler::error("overshot token list length in expression, this can be caused by a miriad of issues", tokens[tokens.size() - 1].getLine());
             exit(1);
         }
+
+        // New AST nodes take the location of the last token read.
+        AST::MasterAST::CurLoc = {tokens[currentTokenIndex].getLine(), tokens[currentTokenIndex].getCharacter()};
         return tokens[currentTokenIndex];
     }
 
@@ -44,6 +47,13 @@ namespace Dorset
         return std::move(output);
     }
 
+    AST::ExprAST *ExpressionBuilder::parseBoolExpr()
+    {
+        AST::BoolExprAST *output = new AST::BoolExprAST(currentToken().getType() == _TRUE);
+        advanceToken();
+        return std::move(output);
+    }
+
     AST::ExprAST *ExpressionBuilder::parseStringExpr()
     {
         AST::StringExprAST *output = new AST::StringExprAST(currentToken().getLiteral());
@@ -235,6 +245,11 @@ namespace Dorset
             auto Expr = parseNumberExpr();
             return Expr;
         }
+        else if (currentToken().getType() == _TRUE || currentToken().getType() == _FALSE)
+        {
+            auto Expr = parseBoolExpr();
+            return Expr;
+        }
         else if (currentToken().getType() == STRING)
         {
             auto Expr = parseStringExpr();
@@ -276,6 +291,7 @@ namespace Dorset
 
             // Okay, we know this is a binop.
             std::string BinOp = currentToken().getLexeme();
+            AST::SourceLocation BinLoc = AST::MasterAST::CurLoc;
             advanceToken(); // eat binop
 
             // Parse the unary expression after the binary operator.
@@ -294,6 +310,7 @@ namespace Dorset
             
             // Merge LHS/RHS.
             LHS = new AST::BinaryExprAST(BinOp, std::move(LHS), std::move(RHS));
+            LHS->setLocation(BinLoc);
         }
     }
 
@@ -1,9 +1,21 @@
 #include <dorset-lang/Driver/CLI.h>
 
+#include <dorset-lang/Driver/Repl.h>
+#include <dorset-lang/Utils/Version.h>
+
+#include <mutex>
+#include <regex>
+
 #ifndef DORSET_OBJECT_COMPILER
 #define DORSET_OBJECT_COMPILER "gcc"
 #endif
 
+#if defined(_WIN64) || defined(_WIN32)
+#define DORSET_OBJECT_EXTENSION ".obj"
+#else
+#define DORSET_OBJECT_EXTENSION ".o"
+#endif
+
 namespace Dorset
 {
     bool fileExists(std::string fileName)
@@ -95,14 +107,33 @@ namespace Dorset
             outputFinal = currentArgument();
             hasOutputName = true;
         }
-        // else if (currentArgument() == "-l" || currentArgument() == "--library")
-        // {
-        //     isLibrary = true;
-        // }
+        else if (currentArgument().rfind("--library=", 0) == 0)
+        {
+            std::string kind = currentArgument().substr(std::string("--library=").size());
+            if (kind != "static" && kind != "shared")
+            {
+                error("Library must be static or shared.");
+                return;
+            }
+            isLibrary = true;
+            isSharedLibrary = kind == "shared";
+        }
         else if (currentArgument() == "-r" || currentArgument() == "--llvmir")
         {
             generateLLVMIR = true;
         }
+        else if (currentArgument() == "--emit-bc")
+        {
+            generateBitcode = true;
+        }
+        else if (currentArgument() == "-S")
+        {
+            generateAssembly = true;
+        }
+        else if (currentArgument() == "-c")
+        {
+            objectOnly = true;
+        }
         else if (currentArgument() == "-b" || currentArgument() == "--keepbin")
         {
             deleteBinaries = false;
@@ -113,6 +144,99 @@ namespace Dorset
             advanceArgument();
             rawCode = currentArgument();
         }
+        else if (currentArgument() == "--cache")
+        {
+            useCache = true;
+        }
+        else if (currentArgument() == "--cache-dir")
+        {
+            advanceArgument();
+            if (currentArgument() == "")
+            {
+                error("No argument given to cache directory flag.");
+                return;
+            }
+            cacheDirectory = currentArgument();
+            useCache = true;
+        }
+        else if (currentArgument() == "--time-report")
+        {
+            isTimeReport = true;
+        }
+        else if (currentArgument() == "--time-report-json")
+        {
+            advanceArgument();
+            if (currentArgument() == "")
+            {
+                error("No argument given to time report flag.");
+                return;
+            }
+            timeReportFile = currentArgument();
+        }
+        else if (currentArgument().rfind("-ftime-trace=", 0) == 0)
+        {
+            timeTraceFile = currentArgument().substr(std::string("-ftime-trace=").size());
+            if (timeTraceFile == "")
+            {
+                error("No file given to time trace flag.");
+                return;
+            }
+        }
+        else if (currentArgument() == "-fprofile-generate" || currentArgument().rfind("-fprofile-generate=", 0) == 0)
+        {
+            profileGenerate = true;
+            if (currentArgument() != "-fprofile-generate")
+            {
+                profileGenerateFile = currentArgument().substr(std::string("-fprofile-generate=").size());
+            }
+        }
+        else if (currentArgument() == "--emit-interface")
+        {
+            emitInterface = true;
+        }
+        else if (currentArgument() == "-flto")
+        {
+            isLTO = true;
+        }
+        else if (currentArgument() == "-g")
+        {
+            debugInfo = true;
+        }
+        else if (currentArgument() == "-finstrument-functions")
+        {
+            instrumentFunctions = true;
+        }
+        else if (currentArgument().rfind("-fprofile-use=", 0) == 0)
+        {
+            profileUseFile = currentArgument().substr(std::string("-fprofile-use=").size());
+            if (!fileExists(profileUseFile))
+            {
+                error("Profile file does not exist.");
+                return;
+            }
+        }
+        else if (currentArgument() == "--server")
+        {
+            isServer = true;
+        }
+        else if (currentArgument() == "--client")
+        {
+            isClient = true;
+        }
+        else if (currentArgument() == "--repl")
+        {
+            isRepl = true;
+        }
+        else if (currentArgument() == "--socket")
+        {
+            advanceArgument();
+            if (currentArgument() == "")
+            {
+                error("No argument given to socket flag.");
+                return;
+            }
+            socketPath = currentArgument();
+        }
         else
         {
             error("Flag not recognised.");
@@ -121,18 +245,26 @@ namespace Dorset
 
     void CompilerOptions::processFile()
     {
-        if (!hasSourceFile && !hasRawCode) // only read the first source file (only one source supported 0.1.4)
+        if (hasRawCode)
         {
-            if (!fileExists(currentArgument()))
-            {
-                error("File does not exist.");
-                return;
-            }
+            return;
+        }
+
+        if (!fileExists(currentArgument()))
+        {
+            error("File does not exist.");
+            return;
+        }
 
+        // The first source file names the outputs, the rest are linked in with it.
+        std::string location = std::filesystem::absolute(currentArgument()).generic_string();
+        if (!hasSourceFile)
+        {
             sourceFile = removeForwardSlashes(currentArgument());
-            sourceFileLocation = std::filesystem::absolute(currentArgument()).generic_string();
+            sourceFileLocation = location;
             hasSourceFile = true;
         }
+        sourceFileLocations.push_back(location);
     }
 
     void CompilerOptions::constructOutputBinaryNames()
@@ -150,14 +282,15 @@ namespace Dorset
             name = removeFileExtension(sourceFile);
 
     #if defined(_WIN64) || defined(_WIN32)
-            outputFinal = currentPath + "/" + name + ".exe";
+            std::string extension = isLibrary ? (isSharedLibrary ? ".dll" : ".lib") : ".exe";
     #else
-            outputFinal = currentPath + "/" + name + ".out";
+            std::string extension = isLibrary ? (isSharedLibrary ? ".so" : ".a") : ".out";
     #endif
-
+            outputFinal = currentPath + "/" + name + extension;
         }
 
         outputLL = currentPath + "/" + name + ".ll";
+        outputBC = currentPath + "/" + name + ".bc";
     #if defined(_WIN64) || defined(_WIN32)
         outputO = currentPath + "/"  + name + ".obj";
     #else
@@ -199,6 +332,11 @@ namespace Dorset
         {
             error("Cannot display tokens without an input source file.");
         }
+
+        if (profileGenerate && profileUseFile != "")
+        {
+            error("Cannot generate and use a profile at the same time.");
+        }
     }
 
     CompilerOptions::CompilerOptions(int argc, char *argv[])
@@ -234,6 +372,31 @@ namespace Dorset
         {
             error("Cannot display tokens without an input source file.");
         }
+
+        if (profileGenerate && profileUseFile != "")
+        {
+            error("Cannot generate and use a profile at the same time.");
+        }
+    }
+
+    std::vector<std::string> CompilerOptions::getServerArguments()
+    {
+        // Everything but the flags that pick the server.
+        std::vector<std::string> forwarded;
+        for (unsigned int i = 0; i < arguments.size(); i++)
+        {
+            if (arguments[i] == "--client")
+            {
+                continue;
+            }
+            if (arguments[i] == "--socket")
+            {
+                i++;
+                continue;
+            }
+            forwarded.push_back(arguments[i]);
+        }
+        return forwarded;
     }
 
     bool CompilerOptions::getHadError() 
@@ -263,10 +426,113 @@ namespace Dorset
         return lexer.scanTokens();
     }
 
-    void Compiler::buildAST(std::vector<Token> tokens)
+    void Compiler::buildAST(std::vector<Token> tokens, AST::FunctionCache *functionCache, std::string directory)
     {
-        ASTBuilder parser = ASTBuilder(tokens);
+        ASTBuilder parser = ASTBuilder(tokens, functionCache, directory);
         parser.parseTokenList();
+
+        // Bring in the bodies of the functions that were unchanged since the last build.
+        if (functionCache && !ErrorHandler::HadError)
+        {
+            functionCache->linkCachedFunctions();
+        }
+    }
+
+    void Compiler::buildModule(unsigned index, std::string contents, bool useFunctionCache)
+    {
+        std::string sourceName = options.sourceFile;
+        if (index > 0)
+        {
+            sourceName = options.removeForwardSlashes(options.sourceFileLocations[index]);
+        }
+
+        std::vector<Token> tokens;
+        {
+            CompilerPhase phase(timeReport.get(), "lex", "Lexing");
+            tokens = lex(contents);
+        }
+        addCount("tokens", tokens.size());
+
+
+        if (options.isTokens)
+        {
+            printTokens(tokens);
+        }
+
+        {
+            CompilerPhase phase(timeReport.get(), "frontend", "Parsing and IR generation");
+            AST::MasterAST::initializeModule(sourceName.c_str());
+            AST::createExternalFunctions();
+            AST::MasterAST::InstrumentFunctions = options.instrumentFunctions;
+            std::filesystem::path source = getModuleSource(index);
+            if (options.debugInfo)
+            {
+                AST::MasterAST::initializeDebugInfo(source.filename().string(), source.parent_path().string());
+            }
+
+            // On a miss for the whole file, only the functions that changed are lowered again.
+            // Cached functions carry no line tables, so '-g' always lowers everything.
+            std::unique_ptr<AST::FunctionCache> functionCache;
+            if (useFunctionCache && !options.debugInfo)
+            {
+                functionCache = std::make_unique<AST::FunctionCache>(options.cacheDirectory, computeFunctionCacheKey(sourceName));
+            }
+            buildAST(tokens, functionCache.get(), source.parent_path().string());
+
+            if (options.instrumentFunctions)
+            {
+                AST::createProfileDump();
+            }
+            AST::MasterAST::finalizeDebugInfo();
+        }
+        addCount("ast_nodes", AST::MasterAST::NodeCount);
+        addCount("ir_functions", AST::MasterAST::TheModule->getFunctionList().size());
+        addCount("ir_instructions", AST::MasterAST::TheModule->getInstructionCount());
+    }
+
+    void Compiler::writeInterface(unsigned index, std::string contents)
+    {
+        CompilerPhase phase(timeReport.get(), "emit_interface", "Interface emission");
+
+        // Only the file's own exports, not what it imported or declared extern.
+        std::vector<AST::PrototypeAST*> exported;
+        for (auto &proto : AST::MasterAST::FunctionProtos)
+        {
+            if (proto.second->isExported())
+            {
+                exported.push_back(proto.second);
+            }
+        }
+        if (exported.empty())
+        {
+            return;
+        }
+
+        AST::ModuleInterface interface = AST::ModuleInterface(CompilationCache::hash({contents}), exported);
+        interface.addBodies();
+
+        std::string path = AST::ModuleInterface::getInterfacePath(getModuleSource(index));
+        if (!interface.write(path))
+        {
+            ErrorHandler::error("could not write the interface file: " + path);
+        }
+    }
+
+    std::vector<std::string> Compiler::getImportedFiles(std::string contents, std::string directory)
+    {
+        // A textual scan, the cache is looked up before anything is lexed.
+        std::vector<std::string> files;
+        std::regex pattern("import\\s*\"([^\"]*)\"");
+        for (std::sregex_iterator match(contents.begin(), contents.end(), pattern), end; match != end; ++match)
+        {
+            std::filesystem::path path = (*match)[1].str();
+            if (path.is_relative())
+            {
+                path = std::filesystem::path(directory) / path;
+            }
+            files.push_back(std::filesystem::absolute(path).lexically_normal().generic_string());
+        }
+        return files;
     }
 
     Compiler::Compiler(CompilerOptions options) : options{options}
@@ -281,6 +547,27 @@ namespace Dorset
             return 1;
         }
 
+        if (options.isServer)
+        {
+            return CompileServer(options.socketPath).run();
+        }
+
+        // The REPL reads this terminal, so it always runs here, even with --client.
+        if (options.isRepl)
+        {
+            return Repl().run(std::cin, std::cout);
+        }
+
+        // Hand the compile to a running server, or do it here if there is none.
+        if (options.isClient)
+        {
+            int status = forwardToServer(options.socketPath, options.getServerArguments());
+            if (status >= 0)
+            {
+                return status;
+            }
+        }
+
         if (options.isHelp)
         {
             printUsage();
@@ -291,33 +578,140 @@ namespace Dorset
         }
         else if (options.hasSourceFile || options.hasRawCode)
         {
-            std::vector<Token> tokens;
-            if (options.hasRawCode) 
+            // The bitcode written for a module must not replace a bitcode input, as
+            // './main.bc -flto --emit-bc' would name the linked program's main.bc.
+            // Checked before the report and trace are set up, which the epilogue tears down.
+            if (options.generateBitcode && !checkBitcodeOutputs())
             {
-                tokens = lex(options.rawCode);
+                return 1;
             }
-            else 
+
+            if (options.isTimeReport || options.timeReportFile != "")
+            {
+                timeReport = std::make_unique<TimeReport>();
+            }
+            if (options.timeTraceFile != "")
             {
-                tokens = lex(getSourceContents(options.sourceFileLocation));
+                timeTraceProfilerInitialize(0, "dorsetc");
             }
 
+            std::string contents;
+            {
+                CompilerPhase phase(timeReport.get(), "read", "Reading the source");
+                if (options.hasRawCode) 
+                {
+                    contents = options.rawCode;
+                }
+                else 
+                {
+                    contents = getSourceContents(options.sourceFileLocation);
+                }
+            }
 
-            if (options.isTokens)
+            // Printing tokens and writing interfaces need the front end to run, so skip the cache for them.
+            std::string cacheKey;
+            bool restored = false;
+            if (options.useCache && !options.isTokens && !options.emitInterface)
             {
-                printTokens(tokens);
+                CompilerPhase phase(timeReport.get(), "cache_lookup", "Cache lookup");
+                cacheKey = computeCacheKey(contents);
+                restored = restoreFromCache(cacheKey);
+            }
+            if (restored)
+            {
+                printTimeReport();
+                writeTimeTrace();
+                return 0;
+            }
+
+            // Without -flto every source file becomes its own object. With it they are
+            // lowered to bitcode and merged into one module, optimized as a whole.
+            std::vector<std::string> objectFiles;
+            std::vector<std::string> bitcodeFiles;
+            std::string codeExtension = options.generateAssembly ? ".s" : DORSET_OBJECT_EXTENSION;
+            for (unsigned i = 0; i < getModuleCount() && !ErrorHandler::HadError; i++)
+            {
+                // Bitcode given on the command line has already been through the front end.
+                if (isBitcodeInput(i))
+                {
+                    if (options.isLTO)
+                    {
+                        bitcodeFiles.push_back(getModuleSource(i));
+                    }
+                    else
+                    {
+                        linkBitcode(getModuleSource(i), { getModuleSource(i) });
+                        if (!ErrorHandler::HadError)
+                        {
+                            objectFiles.push_back(getModuleOutput(i, codeExtension));
+                            emitModule(objectFiles.back(), getModuleOutput(i, ".ll"), "", false);
+                        }
+                    }
+                    continue;
+                }
+
+                if (i > 0)
+                {
+                    CompilerPhase phase(timeReport.get(), "read", "Reading the source");
+                    contents = getSourceContents(options.sourceFileLocations[i]);
+                }
+
+                buildModule(i, contents, !cacheKey.empty());
+                if (options.emitInterface && !options.hasRawCode && !ErrorHandler::HadError)
+                {
+                    writeInterface(i, contents);
+                }
+                if (ErrorHandler::HadError)
+                {
+                    break;
+                }
+
+                if (options.isLTO)
+                {
+                    bitcodeFiles.push_back(getModuleOutput(i, ".lto.bc"));
+                    writeBitcode(bitcodeFiles.back());
+                }
+                else
+                {
+                    objectFiles.push_back(getModuleOutput(i, codeExtension));
+                    emitModule(objectFiles.back(), getModuleOutput(i, ".ll"), getModuleOutput(i, ".bc"), false);
+                }
+            }
+
+            if (options.isLTO && !ErrorHandler::HadError)
+            {
+                linkBitcode(options.sourceFile, bitcodeFiles);
+                if (!ErrorHandler::HadError)
+                {
+                    objectFiles.push_back(options.generateAssembly ? options.outputS : options.outputO);
+                    emitModule(objectFiles.back(), options.outputLL, options.outputBC, true);
+                }
             }
-            AST::MasterAST::initializeModule(options.sourceFile.c_str());
-            AST::createExternalFunctions();
-            buildAST(tokens);
 
             if (!ErrorHandler::HadError)
             {
-                outputBinaries();
-                if (options.deleteBinaries) 
+                // With -c or -S the build system links the outputs itself.
+                if (isLinked() && options.isLibrary && !options.isSharedLibrary)
+                {
+                    writeArchive(objectFiles);
+                }
+                else if (isLinked())
                 {
-                    removeBinaries();
+                    linkExecutable(objectFiles);
                 }
+                if (!cacheKey.empty() && !ErrorHandler::HadError)
+                {
+                    CompilerPhase phase(timeReport.get(), "cache_store", "Cache store");
+                    storeInCache(cacheKey);
+                }
+            }
+            if (options.deleteBinaries) 
+            {
+                removeBinaries();
             }
+
+            printTimeReport();
+            writeTimeTrace();
         }
         else
         {
@@ -330,60 +724,567 @@ namespace Dorset
         return 0;
     }
 
-    void Compiler::outputBinaries()
+    std::string Compiler::computeCacheKey(std::string contents)
+    {
+        // Everything that can change the build outputs has to be part of the key.
+        std::vector<std::string> inputs = {
+            contents,
+            options.sourceFile,
+            getVersion().to_string(),
+            getCommitHash(),
+            options.targetTriple,
+            options.targetCPU,
+            options.targetFeatures,
+            DORSET_OBJECT_COMPILER,
+            options.generateLLVMIR ? "llvmir" : "",
+            options.generateBitcode ? "bitcode" : "",
+            options.generateAssembly ? "assembly" : "",
+            options.objectOnly ? "object-only" : "",
+            options.deleteBinaries ? "" : "keepbin",
+            options.isLibrary ? (options.isSharedLibrary ? "library=shared" : "library=static") : "",
+            options.profileGenerate ? "profile-generate=" + options.profileGenerateFile : "",
+            options.profileUseFile != "" ? "profile-use=" + getSourceContents(options.profileUseFile) : "",
+            options.instrumentFunctions ? "instrument-functions" : "",
+            options.debugInfo ? "debug=" + options.sourceFileLocation : "",
+            options.isLTO ? "lto" : "",
+        };
+
+        // The files linked in with the first one.
+        for (unsigned i = 1; i < getModuleCount(); i++)
+        {
+            inputs.push_back(options.sourceFileLocations[i]);
+            inputs.push_back(getSourceContents(options.sourceFileLocations[i]));
+        }
+
+        // Imported declarations and bodies end up in the outputs too.
+        for (unsigned i = 0; i < getModuleCount(); i++)
+        {
+            if (isBitcodeInput(i))
+            {
+                continue;
+            }
+
+            std::string source = i == 0 ? contents : getSourceContents(options.sourceFileLocations[i]);
+            for (auto &file : getImportedFiles(source, std::filesystem::path(getModuleSource(i)).parent_path().string()))
+            {
+                inputs.push_back(file);
+                inputs.push_back(getSourceContents(file));
+                inputs.push_back(getSourceContents(AST::ModuleInterface::getInterfacePath(file)));
+            }
+        }
+
+        return CompilationCache::hash(inputs);
+    }
+
+    std::string Compiler::computeFunctionCacheKey(std::string sourceName)
+    {
+        // Function IR does not depend on which outputs are kept, only on the compiler and target.
+        std::vector<std::string> inputs = {
+            "function",
+            sourceName,
+            getVersion().to_string(),
+            getCommitHash(),
+            options.targetTriple,
+            options.targetCPU,
+            options.targetFeatures,
+            options.instrumentFunctions ? "instrument-functions" : "",
+        };
+
+        return CompilationCache::hash(inputs);
+    }
+
+    std::vector<std::pair<std::string, std::string>> Compiler::getCachedOutputs()
+    {
+        // The outputs that survive removeBinaries, as (cache extension, path) pairs.
+        std::vector<std::pair<std::string, std::string>> outputs;
+        if (isLinked())
+        {
+            outputs.push_back({".out", options.outputFinal});
+        }
+        if (options.generateAssembly)
+        {
+            outputs.push_back({".s", options.outputS});
+        }
+        else if (options.objectOnly || !options.deleteBinaries)
+        {
+            outputs.push_back({".o", options.outputO});
+        }
+        if (options.generateLLVMIR || !options.deleteBinaries)
+        {
+            outputs.push_back({".ll", options.outputLL});
+        }
+        if (options.generateBitcode && !isBitcodeInput(0))
+        {
+            outputs.push_back({".bc", options.outputBC});
+        }
+
+        // The intermediates of every other source file, or the bitcode of each with -flto.
+        for (unsigned i = 0; i < getModuleCount(); i++)
+        {
+            std::string prefix = "." + std::to_string(i);
+            if (options.isLTO && !options.deleteBinaries && !isBitcodeInput(i))
+            {
+                outputs.push_back({prefix + ".lto.bc", getModuleOutput(i, ".lto.bc")});
+            }
+            else if (!options.isLTO && i > 0)
+            {
+                if (options.generateAssembly)
+                {
+                    outputs.push_back({prefix + ".s", getModuleOutput(i, ".s")});
+                }
+                else if (options.objectOnly || !options.deleteBinaries)
+                {
+                    outputs.push_back({prefix + ".o", getModuleOutput(i, DORSET_OBJECT_EXTENSION)});
+                }
+                if (options.generateLLVMIR || !options.deleteBinaries)
+                {
+                    outputs.push_back({prefix + ".ll", getModuleOutput(i, ".ll")});
+                }
+                if (options.generateBitcode && !isBitcodeInput(i))
+                {
+                    outputs.push_back({prefix + ".bc", getModuleOutput(i, ".bc")});
+                }
+            }
+        }
+        return outputs;
+    }
+
+    bool Compiler::restoreFromCache(std::string key)
+    {
+        CompilationCache cache = CompilationCache(options.cacheDirectory);
+
+        auto outputs = getCachedOutputs();
+        for (auto &output : outputs)
+        {
+            if (!cache.contains(key, output.first))
+            {
+                return false;
+            }
+        }
+
+        for (auto &output : outputs)
+        {
+            if (!cache.restore(key, output.first, output.second))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Compiler::storeInCache(std::string key)
+    {
+        CompilationCache cache = CompilationCache(options.cacheDirectory);
+
+        for (auto &output : getCachedOutputs())
+        {
+            cache.store(key, output.first, output.second);
+        }
+    }
+
+    void Compiler::addCount(std::string name, uint64_t value)
+    {
+        if (timeReport)
+        {
+            timeReport->addCount(name, value);
+        }
+    }
+
+    void Compiler::printTimeReport()
+    {
+        if (!timeReport)
+        {
+            return;
+        }
+
+        std::cout.flush();
+        if (options.timeReportFile != "")
+        {
+            std::error_code EC;
+            raw_fd_ostream file(options.timeReportFile, EC, sys::fs::OF_Text);
+            if (EC)
+            {
+                ErrorHandler::error("could not write the time report: " + options.timeReportFile);
+            }
+            else
+            {
+                timeReport->printJSON(file);
+            }
+        }
+
+        // Printing also resets the timers, which would otherwise report on exit.
+        timeReport->print(options.isTimeReport ? outs() : nulls());
+    }
+
+    void Compiler::writeTimeTrace()
+    {
+        if (!timeTraceProfilerEnabled())
+        {
+            return;
+        }
+
+        if (auto E = timeTraceProfilerWrite(options.timeTraceFile, options.outputFinal))
+        {
+            consumeError(std::move(E));
+            ErrorHandler::error("could not write the time trace: " + options.timeTraceFile);
+        }
+        timeTraceProfilerCleanup();
+    }
+
+    void Compiler::optimizeModule(TargetMachine *machine, bool isWholeProgram)
+    {
+        LoopAnalysisManager LAM;
+        FunctionAnalysisManager FAM;
+        CGSCCAnalysisManager CGAM;
+        ModuleAnalysisManager MAM;
+
+        PassInstrumentationCallbacks PIC;
+        if (timeReport)
+        {
+            timeReport->registerPassTimers(PIC);
+        }
+        TimeProfilingPassesHandler passTrace;
+        passTrace.registerCallbacks(PIC);
+
+        PassBuilder PB(machine, PipelineTuningOptions(), std::nullopt, &PIC);
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+        ModulePassManager MPM;
+
+        // Inline the user defined operators, which are marked alwaysinline.
+        MPM.addPass(AlwaysInlinerPass());
+
+        // Count every edge in an instrumented build, or annotate the branches with
+        // the weights of a profile, which code generation lays out blocks by.
+        if (options.profileGenerate)
+        {
+            MPM.addPass(PGOInstrumentationGen());
+
+            InstrProfOptions profileOptions;
+            profileOptions.InstrProfileOutput = options.profileGenerateFile;
+            MPM.addPass(InstrProfilingLoweringPass(profileOptions, false));
+        }
+        else if (options.profileUseFile != "")
+        {
+            MPM.addPass(PGOInstrumentationUse(options.profileUseFile));
+        }
+
+        if (isWholeProgram && options.isLibrary)
+        {
+            // A library keeps every exported function, only the calls between files inline.
+            MPM.addPass(PB.buildLTODefaultPipeline(OptimizationLevel::O2, nullptr));
+        }
+        else if (isWholeProgram)
+        {
+            // Every module is linked in, so only 'main' has to stay visible. The exported
+            // functions of each file become internal and inline across the old module
+            // boundaries like any other.
+            MPM.addPass(InternalizePass([](const GlobalValue &GV) { return GV.getName() == "main"; }));
+            MPM.addPass(PB.buildLTODefaultPipeline(OptimizationLevel::O2, nullptr));
+        }
+        else
+        {
+            // Everything but 'main' and exported functions is internal, so constants can
+            // be propagated into and pointer arguments promoted across their call sites.
+            MPM.addPass(IPSCCPPass());
+            MPM.addPass(createModuleToPostOrderCGSCCPassAdaptor(ArgumentPromotionPass()));
+
+            // Drop functions nothing calls anymore, including unused builtins.
+            MPM.addPass(GlobalDCEPass());
+        }
+
+        MPM.run(*AST::MasterAST::TheModule, MAM);
+    }
+
+    void Compiler::initializeTargets()
+    {
+        static std::once_flag initialized;
+        std::call_once(initialized, []()
+        {
+            InitializeAllTargetInfos();
+            InitializeAllTargets();
+            InitializeAllTargetMCs();
+            InitializeAllAsmPrinters();
+            InitializeAllAsmParsers();
+        });
+    }
+
+    TargetMachine *Compiler::getTargetMachine()
+    {
+        if (!targetMachine)
+        {
+            {
+                CompilerPhase phase(timeReport.get(), "targets", "Target initialization");
+                initializeTargets();
+            }
+
+            // Create a target machine (adjust the triple for your target architecture).
+            std::string error;
+            const Target *target = TargetRegistry::lookupTarget(options.targetTriple, error);
+            TargetOptions opt = TargetOptions();
+
+            // Libraries are linked into position independent executables and shared objects.
+            std::optional<Reloc::Model> relocationModel;
+            if (options.isLibrary)
+            {
+                relocationModel = Reloc::PIC_;
+            }
+            targetMachine.reset(target->createTargetMachine(options.targetTriple, options.targetCPU, options.targetFeatures, opt, relocationModel));
+        }
+
+        // Every module is built for the same target.
+        AST::MasterAST::TheModule->setTargetTriple(options.targetTriple);
+        AST::MasterAST::TheModule->setDataLayout(targetMachine->createDataLayout());
+        return targetMachine.get();
+    }
+
+    unsigned Compiler::getModuleCount()
+    {
+        // Raw source is a single module of its own.
+        if (options.hasRawCode || options.sourceFileLocations.empty())
+        {
+            return 1;
+        }
+        return options.sourceFileLocations.size();
+    }
+
+    std::string Compiler::getModuleSource(unsigned index)
+    {
+        // Raw source is compiled as if it were a file in the working directory.
+        if (options.hasRawCode || options.sourceFileLocations.empty())
+        {
+            return std::filesystem::current_path().generic_string() + "/" + options.sourceFile;
+        }
+        return options.sourceFileLocations[index];
+    }
+
+    std::string Compiler::getModuleOutput(unsigned index, std::string extension)
+    {
+        // The first module's outputs follow '-o', the others are named after their file.
+        auto getName = [&](unsigned i)
+        {
+            if (i == 0)
+            {
+                return options.removeFileExtension(options.outputO);
+            }
+            return std::filesystem::current_path().string() + "/" + options.removeFileExtension(options.removeForwardSlashes(options.sourceFileLocations[i]));
+        };
+
+        // Files with the same name in different directories must not share outputs,
+        // so a name that an earlier module already has gets the module's position.
+        std::string name = getName(index);
+        for (unsigned i = 0; i < index; i++)
+        {
+            if (getName(i) == name)
+            {
+                name += "." + std::to_string(index);
+                break;
+            }
+        }
+        return name + extension;
+    }
+
+    bool Compiler::isBitcodeInputPath(std::string path)
+    {
+        std::error_code ec;
+        std::filesystem::path file = std::filesystem::weakly_canonical(path, ec);
+        for (unsigned i = 0; i < getModuleCount(); i++)
+        {
+            if (isBitcodeInput(i) && std::filesystem::weakly_canonical(getModuleSource(i), ec) == file)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Compiler::checkBitcodeOutputs()
+    {
+        std::vector<std::string> outputs;
+        if (options.isLTO)
+        {
+            outputs.push_back(options.outputBC);
+        }
+        else
+        {
+            for (unsigned i = 0; i < getModuleCount(); i++)
+            {
+                if (!isBitcodeInput(i))
+                {
+                    outputs.push_back(getModuleOutput(i, ".bc"));
+                }
+            }
+        }
+
+        for (auto &output : outputs)
+        {
+            if (isBitcodeInputPath(output))
+            {
+                ErrorHandler::error("--emit-bc would overwrite the input " + output + ", name the output with -o");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Compiler::isBitcodeInput(unsigned index)
     {
-        InitializeAllTargetInfos();
-        InitializeAllTargets();
-        InitializeAllTargetMCs();
-        InitializeAllAsmPrinters();
-        InitializeAllAsmParsers();
+        if (options.hasRawCode || options.sourceFileLocations.empty())
+        {
+            return false;
+        }
+        return std::filesystem::path(options.sourceFileLocations[index]).extension() == ".bc";
+    }
 
-        // Create a target machine (adjust the triple for your target architecture).
-        std::string triple = sys::getDefaultTargetTriple();
-        AST::MasterAST::TheModule->setTargetTriple(triple);
-        std::string error;
-        const Target *target = TargetRegistry::lookupTarget(triple, error);
-        TargetOptions opt = TargetOptions();
-        TargetMachine *machine = target->createTargetMachine(triple, "generic", "", opt, std::optional<Reloc::Model>());
+    bool Compiler::isLinked()
+    {
+        return !options.objectOnly && !options.generateAssembly;
+    }
 
-        AST::MasterAST::TheModule->setDataLayout(machine->createDataLayout());
+    void Compiler::emitModule(std::string codeFile, std::string irFile, std::string bitcodeFile, bool isWholeProgram)
+    {
+        TargetMachine *machine = getTargetMachine();
+
+        {
+            CompilerPhase phase(timeReport.get(), "optimize", "Optimization");
+            optimizeModule(machine, isWholeProgram);
+        }
+        addCount("ir_instructions_optimized", AST::MasterAST::TheModule->getInstructionCount());
 
         // Generate the LLVM IR file
         if (options.generateLLVMIR || !options.deleteBinaries)
         {
-            std::string ir;
-            raw_string_ostream ostream(ir);
-            ostream << *AST::MasterAST::TheModule;
-            ostream.flush();
+            CompilerPhase phase(timeReport.get(), "emit_ir", "LLVM IR emission");
+            std::error_code EC;
+            raw_fd_ostream file(irFile, EC, sys::fs::OF_Text);
+            if (EC)
+            {
+                ErrorHandler::error("could not write LLVM IR file: " + irFile);
+                return;
+            }
+            AST::MasterAST::TheModule->print(file, nullptr);
+        }
 
-            std::ofstream irFile;
-            irFile.open(options.outputLL);
-            irFile << ir;
-            irFile.close();
+        // Generate the bitcode file, which is smaller and much faster to read back than the IR.
+        if (options.generateBitcode && bitcodeFile != "")
+        {
+            writeBitcode(bitcodeFile);
         }
 
-        // Generate the object file.
-        std::error_code EC;
-        raw_fd_ostream dest(options.outputO, EC, sys::fs::OF_None);
+        // Generate the object file, or the assembly with -S.
+        {
+            CompilerPhase phase(timeReport.get(), "emit_object", "Object emission");
+            std::error_code EC;
+            raw_fd_ostream dest(codeFile, EC, options.generateAssembly ? sys::fs::OF_Text : sys::fs::OF_None);
+            if (EC)
+            {
+                ErrorHandler::error("could not write output file: " + codeFile);
+                return;
+            }
+
+            CodeGenFileType fileType = options.generateAssembly ? CodeGenFileType::AssemblyFile : CodeGenFileType::ObjectFile;
+            legacy::PassManager pass;
+            if (machine->addPassesToEmitFile(pass, dest, nullptr, fileType)) 
+            {
+                ErrorHandler::error(options.generateAssembly ? "can't emit assembly file" : "can't emit object file");
+                return;
+            }
+
+            pass.run(*AST::MasterAST::TheModule);
+            dest.flush();
+        }
+    }
+
+    void Compiler::writeBitcode(std::string bitcodeFile)
+    {
+        // Stamp the target so the modules agree when they are linked.
+        getTargetMachine();
 
-        legacy::PassManager pass;
-        if (machine->addPassesToEmitFile(pass, dest, nullptr, CodeGenFileType::ObjectFile)) 
+        CompilerPhase phase(timeReport.get(), "emit_bitcode", "Bitcode emission");
+        std::error_code EC;
+        raw_fd_ostream dest(bitcodeFile, EC, sys::fs::OF_None);
+        if (EC)
         {
-            ErrorHandler::error("can't emit object file");
+            ErrorHandler::error("could not write bitcode file: " + bitcodeFile);
             return;
         }
 
-        pass.run(*AST::MasterAST::TheModule);
-        dest.flush();
+        WriteBitcodeToFile(*AST::MasterAST::TheModule, dest);
+    }
+
+    void Compiler::linkBitcode(std::string moduleName, std::vector<std::string> bitcodeFiles)
+    {
+        CompilerPhase phase(timeReport.get(), "link_bitcode", "Bitcode linking");
+
+        // A fresh module for the whole program, each file's bitcode is read into its context.
+        AST::MasterAST::initializeModule(moduleName.c_str());
+        Linker linker(*AST::MasterAST::TheModule);
+
+        for (auto &bitcodeFile : bitcodeFiles)
+        {
+            auto buffer = MemoryBuffer::getFile(bitcodeFile);
+            if (!buffer)
+            {
+                ErrorHandler::error("could not read bitcode file: " + bitcodeFile);
+                return;
+            }
+
+            auto module = parseBitcodeFile((*buffer)->getMemBufferRef(), *AST::MasterAST::TheContext);
+            if (!module)
+            {
+                consumeError(module.takeError());
+                ErrorHandler::error("could not parse bitcode file: " + bitcodeFile);
+                return;
+            }
+
+            // Only exported functions and 'main' can clash, everything else is internal.
+            if (linker.linkInModule(std::move(*module)))
+            {
+                ErrorHandler::error("could not link " + bitcodeFile + ", a function is defined in more than one file");
+                return;
+            }
+        }
+        addCount("ir_instructions_linked", AST::MasterAST::TheModule->getInstructionCount());
+    }
+
+    void Compiler::linkExecutable(std::vector<std::string> objectFiles)
+    {
+        CompilerPhase phase(timeReport.get(), "link", "Linking");
 
         std::string objComp = DORSET_OBJECT_COMPILER;
 
+        std::string objects;
+        for (auto &objectFile : objectFiles)
+        {
+            objects += objectFile + " ";
+        }
+
     #if defined(_WIN64) || defined(_WIN32)
-        std::string cmd = objComp + " " + options.outputO + " -o " + options.outputFinal;
+        std::string cmd = objComp + " " + objects + "-o " + options.outputFinal;
     #else
-        std::string cmd = objComp + " " + options.outputO + " -o " + options.outputFinal + " -no-pie";
+        std::string cmd = objComp + " " + objects + "-o " + options.outputFinal + (options.isLibrary ? "" : " -no-pie");
     #endif
 
+        if (options.isSharedLibrary)
+        {
+            cmd += " -shared";
+        }
+
+        if (options.profileGenerate)
+        {
+            // The profile runtime ships with clang, other drivers cannot link it.
+            if (objComp.find("clang") == std::string::npos)
+            {
+                ErrorHandler::error("-fprofile-generate needs clang as the object compiler (DORSET_OBJECT_COMPILER)");
+                return;
+            }
+            cmd += " -fprofile-instr-generate";
+        }
+
         if (system(cmd.c_str()) != 0)
         {
             ErrorHandler::error("error during executable generation");
@@ -391,9 +1292,36 @@ namespace Dorset
         }
     }
 
+    void Compiler::writeArchive(std::vector<std::string> objectFiles)
+    {
+        CompilerPhase phase(timeReport.get(), "link", "Linking");
+
+        std::vector<NewArchiveMember> members;
+        for (auto &objectFile : objectFiles)
+        {
+            auto member = NewArchiveMember::getFile(objectFile, true);
+            if (!member)
+            {
+                consumeError(member.takeError());
+                ErrorHandler::error("could not read object file: " + objectFile);
+                return;
+            }
+            members.push_back(std::move(*member));
+        }
+
+        // Written in process with a symbol table, so no 'ar' or 'ranlib' is needed. The
+        // archive is deterministic, without timestamps, so equal builds give equal files.
+        object::Archive::Kind kind = Triple(options.targetTriple).isOSDarwin() ? object::Archive::K_DARWIN : object::Archive::K_GNU;
+        if (Error E = llvm::writeArchive(options.outputFinal, members, SymtabWritingMode::NormalSymtab, kind, true, false))
+        {
+            consumeError(std::move(E));
+            ErrorHandler::error("could not write the library: " + options.outputFinal);
+        }
+    }
+
     void Compiler::removeBinaries()
     {
-        if (!options.isLibrary || ErrorHandler::HadError)
+        if (!options.objectOnly || ErrorHandler::HadError)
         {
             if (fileExists(options.outputO))
             {
@@ -407,9 +1335,54 @@ namespace Dorset
                 system(("rm " + options.outputLL).c_str());
             }
         }
-        if (fileExists(options.outputS))
+        if (!options.generateAssembly || ErrorHandler::HadError)
+        {
+            if (fileExists(options.outputS))
+            {
+                system(("rm " + options.outputS).c_str());
+            }
+        }
+
+        if ((!options.generateBitcode || ErrorHandler::HadError) && !isBitcodeInput(0) && !isBitcodeInputPath(options.outputBC))
+        {
+            if (fileExists(options.outputBC))
+            {
+                system(("rm " + options.outputBC).c_str());
+            }
+        }
+
+        // The bitcode of -flto and the objects, IR and bitcode of the other source files.
+        // Bitcode inputs are the user's own files and are never removed.
+        for (unsigned i = 0; i < getModuleCount(); i++)
         {
-            system(("rm " + options.outputS).c_str());
+            std::vector<std::string> intermediates = { getModuleOutput(i, ".lto.bc") };
+            if (i > 0)
+            {
+                if (!options.objectOnly || ErrorHandler::HadError)
+                {
+                    intermediates.push_back(getModuleOutput(i, DORSET_OBJECT_EXTENSION));
+                }
+                if (!options.generateAssembly || ErrorHandler::HadError)
+                {
+                    intermediates.push_back(getModuleOutput(i, ".s"));
+                }
+                if (!options.generateLLVMIR || ErrorHandler::HadError)
+                {
+                    intermediates.push_back(getModuleOutput(i, ".ll"));
+                }
+                if ((!options.generateBitcode || ErrorHandler::HadError) && !isBitcodeInput(i) && !isBitcodeInputPath(getModuleOutput(i, ".bc")))
+                {
+                    intermediates.push_back(getModuleOutput(i, ".bc"));
+                }
+            }
+
+            for (auto &intermediate : intermediates)
+            {
+                if (fileExists(intermediate))
+                {
+                    system(("rm " + intermediate).c_str());
+                }
+            }
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,641 @@
+#include <dorset-lang/Driver/JitSession.h>
+
+#include <dorset-lang/Driver/CLI.h>
+#include <dorset-lang/AST/FunctionCache.h>
+
+#include <atomic>
+#include <chrono>
+
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+namespace Dorset
+{
+    // The front end builds into global state, so sessions take turns compiling.
+    static std::mutex frontEndMutex;
+
+    // The calls after which a tiered function is recompiled with the full pipeline.
+    static const uint64_t hotCallCount = 1000;
+
+    JitSession::JitSession(JitMode mode) : mode(mode)
+    {
+        Compiler::initializeTargets();
+
+        auto machineBuilder = orc::JITTargetMachineBuilder::detectHost();
+        if (!machineBuilder)
+        {
+            consumeError(machineBuilder.takeError());
+            ErrorHandler::error("could not detect the host target for the JIT");
+            hadError = true;
+            return;
+        }
+
+        // The optimizer tunes for the same machine the JIT generates code for.
+        auto createdMachine = machineBuilder->createTargetMachine();
+        if (!createdMachine)
+        {
+            consumeError(createdMachine.takeError());
+            ErrorHandler::error("could not create a target machine for the JIT");
+            hadError = true;
+            return;
+        }
+        targetMachine = std::move(*createdMachine);
+        orc::JITTargetMachineBuilder tierMachineBuilder = *machineBuilder;
+
+        // Symbols of the host process, like printf, resolve by default.
+        auto created = orc::LLLazyJITBuilder().setJITTargetMachineBuilder(std::move(*machineBuilder)).create();
+        if (!created)
+        {
+            consumeError(created.takeError());
+            ErrorHandler::error("could not create the JIT");
+            hadError = true;
+            return;
+        }
+        jit = std::move(*created);
+
+        // Lazy modules are split up so that a call compiles only the function it reaches.
+        jit->setPartitionFunction(orc::CompileOnDemandLayer::compileRequested);
+
+        // Tiered and incremental sessions swap the code behind a function's stub.
+        if (mode == JitMode::Tiered || mode == JitMode::Incremental)
+        {
+            stubs = orc::createLocalIndirectStubsManagerBuilder(jit->getTargetTriple())();
+        }
+
+        // Tiers are optimized as they are added, everything else as code is generated,
+        // so functions that never run cost nothing. Each tier has a code generator of
+        // its own, the first one only has to be quick. Both tiers generate code on
+        // their own threads, so they compile with a target machine per module.
+        if (mode == JitMode::Tiered)
+        {
+            tierMachineBuilder.setCodeGenOptLevel(CodeGenOptLevel::None);
+            tier0Layer = std::make_unique<orc::IRCompileLayer>(jit->getExecutionSession(), jit->getObjLinkingLayer(),
+                                                               std::make_unique<orc::ConcurrentIRCompiler>(tierMachineBuilder));
+            tierMachineBuilder.setCodeGenOptLevel(CodeGenOptLevel::Aggressive);
+            tier1Layer = std::make_unique<orc::IRCompileLayer>(jit->getExecutionSession(), jit->getObjLinkingLayer(),
+                                                               std::make_unique<orc::ConcurrentIRCompiler>(tierMachineBuilder));
+
+            tierUpThread = std::thread(&JitSession::tierUp, this);
+            return;
+        }
+
+        TargetMachine *machine = targetMachine.get();
+        jit->getIRTransformLayer().setTransform([machine](orc::ThreadSafeModule module, orc::MaterializationResponsibility &)
+        {
+            module.withModuleDo([machine](Module &M) { optimizeModule(M, machine, OptimizationLevel::O2); });
+            return Expected<orc::ThreadSafeModule>(std::move(module));
+        });
+    }
+
+    JitSession::~JitSession()
+    {
+        if (tierUpThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(tieredMutex);
+                isStopping = true;
+            }
+            tierUpSignal.notify_one();
+            tierUpThread.join();
+        }
+    }
+
+    JitSession &JitSession::compile(std::string source)
+    {
+        if (!jit)
+        {
+            return *this;
+        }
+
+        if (mode == JitMode::Incremental)
+        {
+            addDefinitions(source);
+            return *this;
+        }
+
+        orc::ThreadSafeModule module;
+        std::map<Function *, GlobalVariable *> counters;
+        {
+            std::lock_guard<std::mutex> lock(frontEndMutex);
+            bool built = buildModule(source);
+            counters = AST::MasterAST::CallCounters;
+            auto released = AST::MasterAST::releaseModule();
+            if (!built)
+            {
+                hadError = true;
+                return *this;
+            }
+
+            released.second->setDataLayout(jit->getDataLayout());
+            released.second->setTargetTriple(jit->getTargetTriple().str());
+            module = orc::ThreadSafeModule(std::move(released.second), std::move(released.first));
+        }
+
+        // Otherwise the whole module is generated on the first lookup of any of its functions.
+        Error E = mode == JitMode::Tiered ? addTieredModule(std::move(module), counters)
+                : mode == JitMode::Lazy ? jit->addLazyIRModule(std::move(module))
+                : jit->addIRModule(std::move(module));
+        if (E)
+        {
+            consumeError(std::move(E));
+            ErrorHandler::error("could not add the module to the JIT, a function is defined twice");
+            hadError = true;
+        }
+        return *this;
+    }
+
+    bool JitSession::buildModule(std::string source)
+    {
+        // Runs with frontEndMutex held, and leaves the module in MasterAST.
+        ErrorHandler::HadError = false;
+
+        Lexer lexer = Lexer(source);
+        std::vector<Token> tokens = lexer.scanTokens();
+
+        std::string name = "jit_" + std::to_string(moduleCount++);
+        AST::MasterAST::initializeModule(name.c_str());
+        AST::MasterAST::CountCalls = mode == JitMode::Tiered;
+        AST::createExternalFunctions();
+
+        for (Function &F : *AST::MasterAST::TheModule)
+        {
+            if (!F.isDeclaration())
+            {
+                builtins.insert(F.getName().str());
+            }
+        }
+
+        // The functions and operators of earlier sources, declared again on first use.
+        AST::MasterAST::FunctionProtos.insert(prototypes.begin(), prototypes.end());
+        AST::MasterAST::BinopPrecedence.insert(precedences.begin(), precedences.end());
+
+        ASTBuilder parser = ASTBuilder(tokens);
+        parser.parseTokenList();
+        return !ErrorHandler::HadError;
+    }
+
+    std::vector<std::unique_ptr<Module>> JitSession::extractDefinitions(std::string source, orc::ThreadSafeContext &context, bool isDeclared)
+    {
+        // Every definition gets a module of its own, so it can be replaced on its own.
+        std::vector<std::unique_ptr<Module>> modules;
+        std::vector<std::unique_ptr<Module>> builtinModules;
+
+        std::lock_guard<std::mutex> lock(frontEndMutex);
+        if (!buildModule(source))
+        {
+            AST::MasterAST::releaseModule();
+            return modules;
+        }
+
+        for (Function &F : *AST::MasterAST::TheModule)
+        {
+            if (F.isDeclaration())
+            {
+                continue;
+            }
+
+            // The builtins are the same in every source, the session only needs them once.
+            if (builtins.count(F.getName().str()))
+            {
+                if (!hasBuiltins)
+                {
+                    builtinModules.push_back(AST::FunctionCache::extractFunction(&F));
+                }
+                continue;
+            }
+
+            modules.push_back(AST::FunctionCache::extractFunction(&F));
+        }
+
+        // Definitions and extern declarations alike are declared again in later sources.
+        if (isDeclared)
+        {
+            for (auto &proto : AST::MasterAST::FunctionProtos)
+            {
+                if (!builtins.count(proto.first))
+                {
+                    prototypes[proto.first] = proto.second;
+                }
+            }
+            precedences = AST::MasterAST::BinopPrecedence;
+        }
+
+        auto released = AST::MasterAST::releaseModule();
+        context = orc::ThreadSafeContext(std::move(released.first));
+
+        for (auto &module : builtinModules)
+        {
+            module->setDataLayout(jit->getDataLayout());
+            module->setTargetTriple(jit->getTargetTriple().str());
+            if (auto E = jit->addIRModule(orc::ThreadSafeModule(std::move(module), context)))
+            {
+                consumeError(std::move(E));
+            }
+        }
+        hasBuiltins = true;
+
+        for (auto &module : modules)
+        {
+            module->setDataLayout(jit->getDataLayout());
+            module->setTargetTriple(jit->getTargetTriple().str());
+        }
+        return modules;
+    }
+
+    void JitSession::addDefinitions(std::string source)
+    {
+        // Restored if the source does not go in, so the front end never sees its functions.
+        auto previousPrototypes = prototypes;
+        auto previousPrecedences = precedences;
+        auto previousSignatures = signatures;
+        auto rollBack = [&]()
+        {
+            prototypes = previousPrototypes;
+            precedences = previousPrecedences;
+            signatures = previousSignatures;
+            hadError = true;
+        };
+
+        orc::ThreadSafeContext context;
+        std::vector<std::unique_ptr<Module>> modules = extractDefinitions(source, context, true);
+        if (ErrorHandler::HadError)
+        {
+            rollBack();
+            return;
+        }
+
+        // Callers compiled earlier pass the arguments of the old definition.
+        std::vector<std::pair<std::string, std::string>> names; // (function, body) names.
+        for (auto &module : modules)
+        {
+            Function *Body = nullptr;
+            for (Function &F : *module)
+            {
+                if (!F.isDeclaration())
+                {
+                    Body = &F;
+                }
+            }
+
+            std::string signature;
+            raw_string_ostream(signature) << *Body->getFunctionType();
+            std::string name = Body->getName().str();
+            if (signatures.count(name) && signatures[name] != signature)
+            {
+                ErrorHandler::error("'" + name + "' cannot be redefined with different arguments or return type");
+                rollBack();
+                return;
+            }
+            signatures[name] = signature;
+
+            names.push_back({name, name + "." + std::to_string(moduleCount) + "." + std::to_string(names.size())});
+            Body->setName(names.back().second);
+        }
+
+        // Every caller, earlier ones included, goes through a stub of the function's name.
+        orc::SymbolMap symbols;
+        for (auto &name : names)
+        {
+            if (definitions.count(name.first))
+            {
+                continue;
+            }
+
+            if (auto E = stubs->createStub(name.first, orc::ExecutorAddr(), JITSymbolFlags::Exported | JITSymbolFlags::Callable))
+            {
+                consumeError(std::move(E));
+                continue;
+            }
+            symbols[jit->mangleAndIntern(name.first)] = stubs->findStub(name.first, true);
+            definitions[name.first] = nullptr;
+        }
+        if (auto E = jit->getMainJITDylib().define(orc::absoluteSymbols(std::move(symbols))))
+        {
+            consumeError(std::move(E));
+        }
+
+        // Each definition goes in under a tracker of its own, so it can be removed on its own.
+        std::vector<orc::ResourceTrackerSP> trackers;
+        for (auto &module : modules)
+        {
+            trackers.push_back(jit->getMainJITDylib().createResourceTracker());
+            if (auto E = jit->addIRModule(trackers.back(), orc::ThreadSafeModule(std::move(module), context)))
+            {
+                consumeError(std::move(E));
+            }
+        }
+
+        // Either all of the definitions go in or none do, so no stub ends up pointing nowhere.
+        std::vector<orc::ExecutorAddr> bodies;
+        for (auto &name : names)
+        {
+            auto body = jit->lookup(name.second);
+            if (!body)
+            {
+                ErrorHandler::error(toString(body.takeError()));
+                for (auto &tracker : trackers)
+                {
+                    cantFail(tracker->remove());
+                }
+                rollBack();
+                return;
+            }
+            bodies.push_back(*body);
+        }
+
+        for (unsigned i = 0; i < names.size(); i++)
+        {
+            cantFail(stubs->updatePointer(names[i].first, bodies[i]));
+
+            // Nothing reaches the old definition anymore.
+            if (definitions[names[i].first])
+            {
+                cantFail(definitions[names[i].first]->remove());
+            }
+            definitions[names[i].first] = trackers[i];
+        }
+    }
+
+    bool JitSession::evaluate(std::string expression, double &result)
+    {
+        if (!jit || mode != JitMode::Incremental)
+        {
+            return false;
+        }
+
+        // The expression becomes the body of a function of its own, dropped after the call.
+        std::string name = "replExpression" + std::to_string(moduleCount);
+        orc::ThreadSafeContext context;
+        std::vector<std::unique_ptr<Module>> modules = extractDefinitions("fn " + name + "() double { return " + expression + "; }", context, false);
+        if (ErrorHandler::HadError || modules.size() != 1)
+        {
+            return false;
+        }
+
+        orc::ResourceTrackerSP tracker = jit->getMainJITDylib().createResourceTracker();
+        if (auto E = jit->addIRModule(tracker, orc::ThreadSafeModule(std::move(modules.back()), context)))
+        {
+            consumeError(std::move(E));
+            return false;
+        }
+
+        auto address = jit->lookup(name);
+        if (!address)
+        {
+            ErrorHandler::error(toString(address.takeError()));
+            cantFail(tracker->remove());
+            return false;
+        }
+
+        result = address->toPtr<double (*)()>()();
+        cantFail(tracker->remove());
+        return true;
+    }
+
+    Error JitSession::addTieredModule(orc::ThreadSafeModule module, const std::map<Function *, GlobalVariable *> &counters)
+    {
+        // (function, call counter) names of everything called through a stub.
+        std::vector<std::pair<std::string, std::string>> functions;
+
+        module.withModuleDo([&](Module &M)
+        {
+            // Internal names repeat between sources, and every tier has to see them.
+            std::string prefix = M.getName().str() + ".";
+            for (GlobalValue &GV : M.global_values())
+            {
+                if (GV.hasLocalLinkage() && !GV.isDeclaration())
+                {
+                    GV.setName(prefix + GV.getName());
+                    GV.setLinkage(GlobalValue::ExternalLinkage);
+                }
+            }
+
+            for (Function &F : M)
+            {
+                auto counter = counters.find(&F);
+                if (!F.isDeclaration() && counter != counters.end())
+                {
+                    functions.push_back({F.getName().str(), counter->second->getName().str()});
+                }
+            }
+        });
+
+        // Kept in a context of its own, so recompiling never waits on the first tier.
+        auto source = std::make_shared<orc::ThreadSafeModule>(orc::cloneToNewContext(module));
+
+        // Every call, even a recursive one, goes through the stub, the body is renamed.
+        module.withModuleDo([&](Module &M)
+        {
+            for (auto &function : functions)
+            {
+                Function *Body = M.getFunction(function.first);
+                Function *Stub = Function::Create(Body->getFunctionType(), Function::ExternalLinkage, "", M);
+                Body->replaceAllUsesWith(Stub);
+                Body->setName(function.first + ".tier0");
+                Stub->setName(function.first);
+            }
+        });
+
+        orc::SymbolMap symbols;
+        for (auto &function : functions)
+        {
+            if (auto E = stubs->createStub(function.first, orc::ExecutorAddr(), JITSymbolFlags::Exported | JITSymbolFlags::Callable))
+            {
+                return E;
+            }
+            symbols[jit->mangleAndIntern(function.first)] = stubs->findStub(function.first, true);
+        }
+        if (auto E = jit->getMainJITDylib().define(orc::absoluteSymbols(std::move(symbols))))
+        {
+            return E;
+        }
+        if (auto E = tier0Layer->add(jit->getMainJITDylib(), std::move(module)))
+        {
+            return E;
+        }
+
+        // The first tier is generated now, and the stubs pointed at it.
+        std::vector<TieredFunction> added;
+        for (auto &function : functions)
+        {
+            auto body = jit->lookup(function.first + ".tier0");
+            if (!body)
+            {
+                return body.takeError();
+            }
+            if (auto E = stubs->updatePointer(function.first, *body))
+            {
+                return E;
+            }
+
+            auto calls = jit->lookup(function.second);
+            if (!calls)
+            {
+                return calls.takeError();
+            }
+            added.push_back({function.first, calls->toPtr<uint64_t *>(), source});
+        }
+
+        std::lock_guard<std::mutex> lock(tieredMutex);
+        tieredFunctions.insert(tieredFunctions.end(), added.begin(), added.end());
+        return Error::success();
+    }
+
+    void JitSession::tierUp()
+    {
+        std::unique_lock<std::mutex> lock(tieredMutex);
+        while (!isStopping)
+        {
+            tierUpSignal.wait_for(lock, std::chrono::milliseconds(10));
+
+            std::vector<TieredFunction> hot;
+            for (auto &function : tieredFunctions)
+            {
+                if (!function.isPromoted && std::atomic_ref<uint64_t>(*function.calls).load(std::memory_order_relaxed) >= hotCallCount)
+                {
+                    function.isPromoted = true;
+                    hot.push_back(function);
+                }
+            }
+
+            // Recompiling takes a while, and new sources must not wait on it.
+            lock.unlock();
+            for (auto &function : hot)
+            {
+                promote(function);
+                if (stopRequested())
+                {
+                    break;
+                }
+            }
+            lock.lock();
+        }
+    }
+
+    bool JitSession::stopRequested()
+    {
+        std::lock_guard<std::mutex> lock(tieredMutex);
+        return isStopping;
+    }
+
+    void JitSession::promote(const TieredFunction &function)
+    {
+        // The whole source comes along so callees can inline. Their own bodies are only
+        // available externally, the calls left over still go through the stubs.
+        orc::ThreadSafeModule optimized = orc::cloneToNewContext(*function.source);
+        optimized.withModuleDo([&](Module &M)
+        {
+            for (Function &F : M)
+            {
+                if (F.isDeclaration())
+                {
+                    continue;
+                }
+
+                if (F.getName() == function.name)
+                {
+                    F.setName(function.name + ".tier1");
+                }
+                else
+                {
+                    F.setLinkage(GlobalValue::AvailableExternallyLinkage);
+                }
+            }
+
+            for (GlobalVariable &GV : M.globals())
+            {
+                if (GV.isDeclaration())
+                {
+                    continue;
+                }
+
+                // The second tier stops counting, and shares the variables of the first.
+                for (User *U : make_early_inc_range(GV.users()))
+                {
+                    if (auto *Count = dyn_cast<AtomicRMWInst>(U))
+                    {
+                        Count->eraseFromParent();
+                    }
+                }
+
+                if (GV.isConstant())
+                {
+                    GV.setLinkage(GlobalValue::AvailableExternallyLinkage);
+                }
+                else
+                {
+                    GV.setInitializer(nullptr);
+                    GV.setLinkage(GlobalValue::ExternalLinkage);
+                }
+            }
+
+            optimizeModule(M, targetMachine.get(), OptimizationLevel::O3);
+        });
+
+        // Failures only leave the function in the first tier, which still works.
+        if (auto E = tier1Layer->add(jit->getMainJITDylib(), std::move(optimized)))
+        {
+            consumeError(std::move(E));
+            return;
+        }
+
+        auto body = jit->lookup(function.name + ".tier1");
+        if (!body)
+        {
+            consumeError(body.takeError());
+            return;
+        }
+
+        // Calls already running finish in the first tier, new ones start in the second.
+        if (auto E = stubs->updatePointer(function.name, *body))
+        {
+            consumeError(std::move(E));
+            return;
+        }
+        promotedCount++;
+    }
+
+    void JitSession::optimizeModule(Module &module, TargetMachine *machine, OptimizationLevel level)
+    {
+        LoopAnalysisManager LAM;
+        FunctionAnalysisManager FAM;
+        CGSCCAnalysisManager CGAM;
+        ModuleAnalysisManager MAM;
+
+        PassBuilder PB(machine);
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+        ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(level);
+        MPM.run(module, MAM);
+    }
+
+    orc::ExecutorAddr JitSession::lookupAddress(std::string name)
+    {
+        if (!jit)
+        {
+            return orc::ExecutorAddr();
+        }
+
+        auto address = jit->lookup(name);
+        if (!address)
+        {
+            consumeError(address.takeError());
+            return orc::ExecutorAddr();
+        }
+        return *address;
+    }
+
+    bool JitSession::getHadError()
+    {
+        return hadError;
+    }
+
+    unsigned JitSession::getPromotedCount()
+    {
+        return promotedCount.load();
+    }
+}
@@ -0,0 +1,111 @@
+#include <dorset-lang/Driver/Repl.h>
+
+#include <dorset-lang/Utils/Error.h>
+
+#include <sstream>
+
+namespace Dorset
+{
+    Repl::Repl() : session(JitMode::Incremental)
+    {
+    }
+
+    bool Repl::isComplete(const std::string &entry)
+    {
+        // An entry runs on until its braces close, so a definition can span lines.
+        int depth = 0;
+        bool inString = false;
+        for (char c : entry)
+        {
+            if (c == '"')
+            {
+                inString = !inString;
+            }
+            else if (!inString && c == '{')
+            {
+                depth++;
+            }
+            else if (!inString && c == '}')
+            {
+                depth--;
+            }
+        }
+        return depth <= 0;
+    }
+
+    bool Repl::isDefinition(const std::string &entry)
+    {
+        std::stringstream words(entry);
+        std::string first;
+        words >> first;
+        return first == "fn" || first == "export" || first == "extern";
+    }
+
+    void Repl::evaluate(std::string entry, std::ostream &output)
+    {
+        ErrorHandler::HadError = false;
+
+        // An imported file's functions live in its own object, which the session never loads.
+        std::stringstream words(entry);
+        std::string first;
+        if (words >> first && first == "import")
+        {
+            ErrorHandler::error("import is not supported in the REPL, enter the functions instead or declare C functions with extern");
+            return;
+        }
+
+        if (isDefinition(entry))
+        {
+            session.compile(entry);
+            return;
+        }
+
+        // A trailing semicolon is allowed, the expression is returned as it is.
+        size_t end = entry.find_last_not_of(" \t\r\n");
+        if (end != std::string::npos && entry[end] == ';')
+        {
+            entry = entry.substr(0, end);
+        }
+
+        double result;
+        if (session.evaluate(entry, result))
+        {
+            output << result << std::endl;
+        }
+    }
+
+    int Repl::run(std::istream &input, std::ostream &output)
+    {
+        if (session.getHadError())
+        {
+            return 1;
+        }
+
+        std::string entry;
+        std::string line;
+        output << "> " << std::flush;
+        while (std::getline(input, line))
+        {
+            if (entry.empty() && (line == "exit" || line == "quit"))
+            {
+                break;
+            }
+
+            entry += line + "\n";
+            if (!isComplete(entry))
+            {
+                output << ". " << std::flush;
+                continue;
+            }
+
+            if (entry.find_first_not_of(" \t\r\n") != std::string::npos)
+            {
+                evaluate(entry, output);
+            }
+            entry.clear();
+            output << "> " << std::flush;
+        }
+        output << std::endl;
+        return 0;
+    }
+}
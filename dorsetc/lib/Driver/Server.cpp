@@ -0,0 +1,460 @@
+#include <dorset-lang/Driver/Server.h>
+
+#include <dorset-lang/Driver/CLI.h>
+
+#include <llvm/Support/Path.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if !defined(_WIN64) && !defined(_WIN32)
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace Dorset
+{
+#if !defined(_WIN64) && !defined(_WIN32)
+
+    ///////////////////////////
+    //// Socket Framing ///////
+    ///////////////////////////
+
+    // Messages are a 32 bit count followed by that many length prefixed strings.
+
+    static const int ConnectionTimeoutSeconds = 10;
+
+    static bool writeAll(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = write(fd, data, size);
+            if (written <= 0)
+            {
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    static bool readAll(int fd, char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t got = read(fd, data, size);
+            if (got <= 0)
+            {
+                return false;
+            }
+            data += got;
+            size -= got;
+        }
+        return true;
+    }
+
+    static bool sendStrings(int fd, const std::vector<std::string> &strings)
+    {
+        uint32_t count = strings.size();
+        if (!writeAll(fd, (const char *)&count, sizeof(count)))
+        {
+            return false;
+        }
+
+        for (auto &string : strings)
+        {
+            uint32_t size = string.size();
+            if (!writeAll(fd, (const char *)&size, sizeof(size)) || !writeAll(fd, string.data(), size))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool receiveStrings(int fd, std::vector<std::string> &strings)
+    {
+        uint32_t count;
+        if (!readAll(fd, (char *)&count, sizeof(count)))
+        {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t size;
+            if (!readAll(fd, (char *)&size, sizeof(size)))
+            {
+                return false;
+            }
+
+            std::string string(size, '\0');
+            if (!readAll(fd, string.data(), size))
+            {
+                return false;
+            }
+            strings.push_back(string);
+        }
+        return true;
+    }
+
+    static bool makeAddress(std::string socketPath, sockaddr_un &address)
+    {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path))
+        {
+            return false;
+        }
+        std::strcpy(address.sun_path, socketPath.c_str());
+        return true;
+    }
+
+    /// The socket's directory must belong to this user and be writable by no one
+    /// else, otherwise another user could put a socket of their own in its place.
+    /// Sets 'problem' when the directory exists but is not safe.
+    static bool isSafeSocketDirectory(std::string socketPath, bool create, std::string &problem)
+    {
+        std::string directory = sys::path::parent_path(socketPath).str();
+        if (directory.empty())
+        {
+            directory = ".";
+        }
+        if (create)
+        {
+            mkdir(directory.c_str(), 0700);
+        }
+
+        struct stat status;
+        if (lstat(directory.c_str(), &status) != 0)
+        {
+            return false;
+        }
+
+        if (!S_ISDIR(status.st_mode))
+        {
+            problem = directory + " is not a directory";
+        }
+        else if (status.st_uid != getuid())
+        {
+            problem = directory + " belongs to another user";
+        }
+        else if (status.st_mode & (S_IWGRP | S_IWOTH))
+        {
+            problem = directory + " is writable by other users";
+        }
+        else
+        {
+            return true;
+        }
+        return false;
+    }
+
+    /// Whether the process at the other end of 'connection' runs as this user.
+    static bool isSameUser(int connection)
+    {
+#if defined(__linux__)
+        ucred credentials;
+        socklen_t size = sizeof(credentials);
+        if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0)
+        {
+            return false;
+        }
+        return credentials.uid == getuid();
+#else
+        uid_t uid;
+        gid_t gid;
+        if (getpeereid(connection, &uid, &gid) != 0)
+        {
+            return false;
+        }
+        return uid == getuid();
+#endif
+    }
+
+    ///////////////////////////
+    ///// CompileServer ///////
+    ///////////////////////////
+
+    CompileServer::CompileServer(std::string socketPath) : socketPath{socketPath}
+    {
+    }
+
+    std::string CompileServer::defaultSocketPath()
+    {
+        // The runtime directory is private to the user, otherwise use a private
+        // directory of our own, which the server creates.
+        SmallString<128> path;
+        const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+        if (runtime && *runtime)
+        {
+            path = runtime;
+        }
+        else
+        {
+            sys::path::system_temp_directory(true, path);
+            sys::path::append(path, "dorsetc-" + std::to_string(getuid()));
+        }
+        sys::path::append(path, "dorsetc.sock");
+        return std::string(path);
+    }
+
+    int CompileServer::run()
+    {
+        sockaddr_un address;
+        if (!makeAddress(socketPath, address))
+        {
+            ErrorHandler::error("server socket path is too long: " + socketPath);
+            return 1;
+        }
+
+        std::string problem;
+        if (!isSafeSocketDirectory(socketPath, true, problem))
+        {
+            ErrorHandler::error("cannot listen on " + socketPath + ": " + (problem.empty() ? "its directory cannot be created" : problem));
+            return 1;
+        }
+
+        // Only a socket left behind by a server that was killed may be removed,
+        // one that still accepts connections belongs to a running server.
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe < 0)
+        {
+            ErrorHandler::error("could not create the server socket");
+            return 1;
+        }
+        bool running = connect(probe, (sockaddr *)&address, sizeof(address)) == 0;
+        int probeError = errno;
+        close(probe);
+
+        if (running)
+        {
+            ErrorHandler::error("server already running on " + socketPath);
+            return 1;
+        }
+        if (probeError == ECONNREFUSED)
+        {
+            unlink(socketPath.c_str());
+        }
+        else if (probeError != ENOENT)
+        {
+            ErrorHandler::error("could not check for a server on " + socketPath + ": " + std::strerror(probeError));
+            return 1;
+        }
+
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+        {
+            ErrorHandler::error("could not create the server socket");
+            return 1;
+        }
+
+        if (bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+        {
+            ErrorHandler::error("could not listen on " + socketPath);
+            close(listener);
+            return 1;
+        }
+
+        // A client going away mid reply must not take the server down with it.
+        signal(SIGPIPE, SIG_IGN);
+
+        // Pay for target initialization once, instead of in every compile.
+        Compiler::initializeTargets();
+
+        std::cout << "dorsetc server listening on " << socketPath << std::endl;
+
+        while (true)
+        {
+            int connection = accept(listener, nullptr, nullptr);
+            if (connection < 0)
+            {
+                continue;
+            }
+
+            // Compiles run with the server's permissions, so only its own user may ask for one.
+            if (!isSameUser(connection))
+            {
+                close(connection);
+                continue;
+            }
+
+            // Compiles run one at a time, so a client that stalls mid request or stops
+            // reading its reply is dropped rather than holding up every other compile.
+            timeval timeout = { ConnectionTimeoutSeconds, 0 };
+            setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            handle(connection);
+            close(connection);
+        }
+    }
+
+    void CompileServer::handle(int connection)
+    {
+        // The request is the client's working directory followed by its arguments.
+        std::vector<std::string> request;
+        if (!receiveStrings(connection, request) || request.empty())
+        {
+            return;
+        }
+
+        std::string directory = request[0];
+        std::vector<std::string> arguments(request.begin() + 1, request.end());
+
+        if (std::find(arguments.begin(), arguments.end(), "--server") != arguments.end())
+        {
+            sendStrings(connection, {"1", "\033[31mThe server cannot start another server.\033[0m\n"});
+            return;
+        }
+
+        // The REPL would read the server's own input, not the client's.
+        if (std::find(arguments.begin(), arguments.end(), "--repl") != arguments.end())
+        {
+            sendStrings(connection, {"1", "\033[31mThe server cannot run the REPL, run it without --client.\033[0m\n"});
+            return;
+        }
+
+        std::error_code ec;
+        std::filesystem::path serverDirectory = std::filesystem::current_path();
+        std::filesystem::current_path(directory, ec);
+        if (ec)
+        {
+            sendStrings(connection, {"1", "\033[31mThe server cannot enter " + directory + ".\033[0m\n"});
+            return;
+        }
+
+        // Capture everything the compile prints, so it can be replayed by the client.
+        SmallString<128> logPath;
+        int logFD;
+        if (sys::fs::createTemporaryFile("dorsetc-server", "log", logFD, logPath))
+        {
+            sendStrings(connection, {"1", "\033[31mThe server cannot capture compiler output.\033[0m\n"});
+            std::filesystem::current_path(serverDirectory, ec);
+            return;
+        }
+
+        std::cout.flush();
+        fflush(stdout);
+        int savedOut = dup(STDOUT_FILENO);
+        int savedErr = dup(STDERR_FILENO);
+        dup2(logFD, STDOUT_FILENO);
+        dup2(logFD, STDERR_FILENO);
+
+        // Each compile starts from a clean slate, the compiler state is global.
+        ErrorHandler::HadError = false;
+        int status = Compiler(CompilerOptions(arguments)).compile();
+
+        std::cout.flush();
+        fflush(stdout);
+        outs().flush();
+        errs().flush();
+        dup2(savedOut, STDOUT_FILENO);
+        dup2(savedErr, STDERR_FILENO);
+        close(savedOut);
+        close(savedErr);
+        close(logFD);
+
+        std::ifstream log(logPath.c_str(), std::ios::binary);
+        std::stringstream output;
+        output << log.rdbuf();
+        log.close();
+        sys::fs::remove(logPath);
+
+        std::filesystem::current_path(serverDirectory, ec);
+
+        sendStrings(connection, {std::to_string(status), output.str()});
+    }
+
+    int forwardToServer(std::string socketPath, std::vector<std::string> arguments)
+    {
+        sockaddr_un address;
+        if (!makeAddress(socketPath, address))
+        {
+            return -1;
+        }
+
+        std::string problem;
+        if (!isSafeSocketDirectory(socketPath, false, problem))
+        {
+            if (!problem.empty())
+            {
+                ErrorHandler::warning("not using the compile server, " + problem);
+            }
+            return -1;
+        }
+
+        int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connection < 0)
+        {
+            return -1;
+        }
+
+        if (connect(connection, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            close(connection);
+            return -1;
+        }
+
+        // Never hand a compile, or the exit status, to a server run by someone else.
+        if (!isSameUser(connection))
+        {
+            ErrorHandler::warning("not using the compile server on " + socketPath + ", it belongs to another user");
+            close(connection);
+            return -1;
+        }
+
+        std::vector<std::string> request = { std::filesystem::current_path().string() };
+        request.insert(request.end(), arguments.begin(), arguments.end());
+
+        std::vector<std::string> reply;
+        if (!sendStrings(connection, request) || !receiveStrings(connection, reply) || reply.size() != 2)
+        {
+            close(connection);
+            return -1;
+        }
+        close(connection);
+
+        std::cout << reply[1] << std::flush;
+        return std::stoi(reply[0]);
+    }
+
+#else
+
+    CompileServer::CompileServer(std::string socketPath) : socketPath{socketPath}
+    {
+    }
+
+    std::string CompileServer::defaultSocketPath()
+    {
+        return "";
+    }
+
+    int CompileServer::run()
+    {
+        ErrorHandler::error("the compile server is not supported on Windows");
+        return 1;
+    }
+
+    void CompileServer::handle(int connection)
+    {
+    }
+
+    int forwardToServer(std::string socketPath, std::vector<std::string> arguments)
+    {
+        return -1;
+    }
+
+#endif
+}
@@ -0,0 +1,104 @@
+#include <dorset-lang/Driver/TimeReport.h>
+
+#include <llvm/Support/Format.h>
+
+#if !defined(_WIN64) && !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+using namespace llvm;
+
+namespace Dorset
+{
+    TimeReport::TimeReport() : phases{"dorsetc", "Compiler Phases"}, passes{true}
+    {
+    }
+
+    Timer *TimeReport::getPhase(std::string name, std::string description)
+    {
+        for (auto &timer : timers)
+        {
+            if (timer->getName() == name)
+            {
+                return timer.get();
+            }
+        }
+
+        timers.push_back(std::make_unique<Timer>(name, description, phases));
+        return timers.back().get();
+    }
+
+    void TimeReport::registerPassTimers(PassInstrumentationCallbacks &PIC)
+    {
+        passes.registerCallbacks(PIC);
+    }
+
+    void TimeReport::addCount(std::string name, uint64_t value)
+    {
+        // Counts of every module in a multi file build add up.
+        for (auto &count : counts)
+        {
+            if (count.first == name)
+            {
+                count.second += value;
+                return;
+            }
+        }
+        counts.push_back({name, value});
+    }
+
+    uint64_t TimeReport::getPeakRSS()
+    {
+    #if defined(_WIN64) || defined(_WIN32)
+        return 0;
+    #else
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+    #if defined(__APPLE__)
+        return usage.ru_maxrss / 1024;
+    #else
+        return usage.ru_maxrss;
+    #endif
+    #endif
+    }
+
+    CompilerPhase::CompilerPhase(TimeReport *report, std::string name, std::string description)
+        : region{report ? report->getPhase(name, description) : nullptr}, trace{description}
+    {
+    }
+
+    void TimeReport::print(raw_ostream &OS)
+    {
+        // Printing resets the timers, so the JSON has to be written first.
+        passes.setOutStream(OS);
+        passes.print();
+        phases.print(OS, true);
+
+        OS << "===" << std::string(73, '-') << "===\n";
+        OS << "                              Compiler Statistics\n";
+        OS << "===" << std::string(73, '-') << "===\n";
+        for (auto &count : counts)
+        {
+            OS << format("  %-30s %12llu\n", count.first.c_str(), (unsigned long long)count.second);
+        }
+        OS << format("  %-30s %12llu\n", (const char *)"peak_rss_kb", (unsigned long long)getPeakRSS());
+        OS.flush();
+    }
+
+    void TimeReport::printJSON(raw_ostream &OS)
+    {
+        OS << "{\n";
+        const char *delim = TimerGroup::printAllJSONValues(OS, "");
+        for (auto &count : counts)
+        {
+            OS << delim << "\t\"" << count.first << "\": " << count.second;
+            delim = ",\n";
+        }
+        OS << delim << "\t\"peak_rss_kb\": " << getPeakRSS();
+        OS << "\n}\n";
+        OS.flush();
+    }
+}
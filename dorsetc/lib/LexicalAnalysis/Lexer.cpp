@@ -50,7 +50,7 @@ namespace Dorset
         }
         else if (c == '-')
         {
-            addToken(SLASH);
+            addToken(MINUS);
         }
         else if (c == '+')
         {
@@ -64,6 +64,10 @@ namespace Dorset
         {
             addToken(STAR);
         }
+        else if (c == '%')
+        {
+            addToken(PERCENT);
+        }
         else if (c == '|')
         {
             addToken(VERTICAL_BAR);
@@ -131,13 +135,6 @@ namespace Dorset
         {
             string();
         }
-        else if (c == 'o')
-        {
-            if (match('r'))
-            {
-                addToken(OR);
-            }
-        }
         else
         {
             if (isdigit(c))
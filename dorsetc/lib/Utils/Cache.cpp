@@ -0,0 +1,153 @@
+#include <dorset-lang/Utils/Cache.h>
+
+#include <filesystem>
+#include <cstdlib>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA256.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace Dorset
+{
+    CompilationCache::CompilationCache(std::string directory) : directory{directory}
+    {
+    }
+
+    std::string CompilationCache::defaultDirectory()
+    {
+        if (const char *env = std::getenv("DORSET_CACHE_DIR"))
+        {
+            return env;
+        }
+
+        llvm::SmallString<128> path;
+        if (!llvm::sys::path::cache_directory(path))
+        {
+            path = std::filesystem::temp_directory_path().string();
+        }
+        llvm::sys::path::append(path, "dorsetc");
+        return std::string(path.str());
+    }
+
+    std::string CompilationCache::hash(std::vector<std::string> inputs)
+    {
+        llvm::SHA256 hasher;
+        for (auto &input : inputs)
+        {
+            // Separate the inputs so that ("ab", "c") and ("a", "bc") differ.
+            hasher.update(std::to_string(input.size()));
+            hasher.update(":");
+            hasher.update(input);
+        }
+        return llvm::toHex(hasher.result(), true);
+    }
+
+    std::string CompilationCache::entryPath(std::string key, std::string extension)
+    {
+        // Fan entries out over sub directories, like git objects.
+        return directory + "/" + key.substr(0, 2) + "/" + key.substr(2) + extension;
+    }
+
+    bool CompilationCache::contains(std::string key, std::string extension)
+    {
+        std::error_code ec;
+        return std::filesystem::is_regular_file(entryPath(key, extension), ec);
+    }
+
+    std::string CompilationCache::getEntryPath(std::string key, std::string extension)
+    {
+        return entryPath(key, extension);
+    }
+
+    bool CompilationCache::restore(std::string key, std::string extension, std::string destination)
+    {
+        std::string entry = entryPath(key, extension);
+
+        std::error_code ec;
+        std::filesystem::copy_file(entry, destination, std::filesystem::copy_options::overwrite_existing, ec);
+        if (ec)
+        {
+            return false;
+        }
+
+        // Executables need to stay executable.
+        std::filesystem::permissions(destination, std::filesystem::status(entry, ec).permissions(), ec);
+        return true;
+    }
+
+    void CompilationCache::store(std::string key, std::string extension, std::string source)
+    {
+        std::string entry = entryPath(key, extension);
+
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(entry).parent_path(), ec);
+        if (ec)
+        {
+            return;
+        }
+
+        // A name of its own for every writer, threads of one process included.
+        llvm::SmallString<128> temporary;
+        int fd;
+        if (llvm::sys::fs::createUniqueFile(entry + ".tmp%%%%%%", fd, temporary))
+        {
+            return;
+        }
+        llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+
+        std::filesystem::copy_file(source, std::string(temporary), std::filesystem::copy_options::overwrite_existing, ec);
+        if (ec)
+        {
+            std::filesystem::remove(std::string(temporary), ec);
+            return;
+        }
+
+        commit(std::string(temporary), entry);
+    }
+
+    void CompilationCache::storeData(std::string key, std::string extension, std::string data)
+    {
+        std::string entry = entryPath(key, extension);
+
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(entry).parent_path(), ec);
+        if (ec)
+        {
+            return;
+        }
+
+        llvm::SmallString<128> temporary;
+        int fd;
+        if (llvm::sys::fs::createUniqueFile(entry + ".tmp%%%%%%", fd, temporary))
+        {
+            return;
+        }
+
+        llvm::raw_fd_ostream file(fd, true);
+        file << data;
+        file.close();
+        if (file.has_error())
+        {
+            file.clear_error();
+            std::filesystem::remove(std::string(temporary), ec);
+            return;
+        }
+
+        commit(std::string(temporary), entry);
+    }
+
+    void CompilationCache::commit(std::string temporary, std::string entry)
+    {
+        // Write then rename, so concurrent builds never see a half written entry.
+        std::error_code ec;
+        std::filesystem::rename(temporary, entry, ec);
+        if (ec)
+        {
+            std::filesystem::remove(temporary, ec);
+        }
+    }
+}
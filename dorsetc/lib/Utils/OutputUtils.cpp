@@ -21,18 +21,36 @@ namespace Dorset
 {
     void printUsage()
     {
-        std::cout << "Usage: dorsetc [file] <options, ...>             " << std::endl;
-        std::cout << "                                                " << std::endl;
-        std::cout << "Options:                                        " << std::endl;
-        std::cout << "    -t  --tokens   = list all the tokens        " << std::endl;
-        std::cout << "    -h  --help     = print the usage            " << std::endl;
-        std::cout << "    -v  --version  = print the version          " << std::endl;
-        std::cout << "    -o  <filename> = specify the output name    " << std::endl;
-        // std::cout << "    -l  --library  = generate a library file    " << std::endl;
-        std::cout << "    -r  --llvmir   = output LLVM IR file        " << std::endl;
-        std::cout << "    -b  --keepbin  = retain the build binaries  " << std::endl;
-        std::cout << "    -rs <code>     = input the raw source       " << std::endl;
-        std::cout << "                                                " << std::endl;
+        std::cout << "Usage: dorsetc [files, ...] <options, ...>                 " << std::endl;
+        std::cout << "                                                          " << std::endl;
+        std::cout << "Options:                                                  " << std::endl;
+        std::cout << "    -t  --tokens         = list all the tokens            " << std::endl;
+        std::cout << "    -h  --help           = print the usage                " << std::endl;
+        std::cout << "    -v  --version        = print the version              " << std::endl;
+        std::cout << "    -o  <filename>       = specify the output name        " << std::endl;
+        std::cout << "    -r  --llvmir         = output LLVM IR file            " << std::endl;
+        std::cout << "    --emit-bc            = output LLVM bitcode file       " << std::endl;
+        std::cout << "    -S                   = output assembly, do not link   " << std::endl;
+        std::cout << "    -c                   = output objects, do not link    " << std::endl;
+        std::cout << "    --library=<kind>     = build a static or shared library" << std::endl;
+        std::cout << "    -b  --keepbin        = retain the build binaries      " << std::endl;
+        std::cout << "    -rs <code>           = input the raw source           " << std::endl;
+        std::cout << "    --cache              = reuse outputs of equal builds  " << std::endl;
+        std::cout << "    --cache-dir <dir>    = cache in dir, implies --cache  " << std::endl;
+        std::cout << "    --time-report        = print phase and pass timings   " << std::endl;
+        std::cout << "    --time-report-json <file> = write them as JSON          " << std::endl;
+        std::cout << "    -ftime-trace=<file>  = write a Chrome trace of phases " << std::endl;
+        std::cout << "    -fprofile-generate[=<file>] = instrument for a profile  " << std::endl;
+        std::cout << "    -fprofile-use=<file> = optimize with a .profdata file " << std::endl;
+        std::cout << "    -g                   = emit DWARF debug info          " << std::endl;
+        std::cout << "    -flto                = optimize all files as one      " << std::endl;
+        std::cout << "    --emit-interface     = write .dsi interfaces to import" << std::endl;
+        std::cout << "    -finstrument-functions = write a flat profile on exit " << std::endl;
+        std::cout << "    --repl               = evaluate code as it is typed   " << std::endl;
+        std::cout << "    --server             = run a resident compile server  " << std::endl;
+        std::cout << "    --client             = compile on the running server  " << std::endl;
+        std::cout << "    --socket <path>      = the server's Unix socket       " << std::endl;
+        std::cout << "                                                          " << std::endl;
     }
 
     void printVersion()
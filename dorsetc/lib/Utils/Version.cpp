@@ -1,9 +1,18 @@
 #include <dorset-lang/Utils/Version.h>
 
+#ifndef GIT_COMMIT_HASH
+#define GIT_COMMIT_HASH "?"
+#endif
+
 namespace Dorset
 {
     version getVersion()
     {
         return version{0, 2, 1, semver::prerelease::alpha, 0};
     }
+
+    std::string getCommitHash()
+    {
+        return GIT_COMMIT_HASH;
+    }
 }
@@ -0,0 +1,6 @@
+# Runs benchmarkCompare on two reports and fails unless it exits with EXPECTED.
+# ctest itself can only tell a zero exit code from a non-zero one.
+execute_process(COMMAND ${COMPARE} ${BASELINE} ${NEW} ${ARGUMENTS} RESULT_VARIABLE result)
+if(NOT result EQUAL EXPECTED)
+    message(FATAL_ERROR "benchmarkCompare exited with ${result}, expected ${EXPECTED}")
+endif()
@@ -0,0 +1,252 @@
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <llvm/Support/JSON.h>
+
+#include "Statistics.h"
+
+// Compares two '--json' outputs of benchmarkTest, a stored baseline and a new run,
+// and exits with a non-zero code if anything got slower or bigger.
+
+struct CompareSettings
+{
+    std::string baselineFile = "";
+    std::string newFile = "";
+    double threshold = 5.0; // Percent.
+};
+
+// The timed measurements that are gated, the rest of the report is informational.
+static const std::vector<std::string> gatedMeasurements = { "compile", "execute_cpu" };
+
+bool readJSON(std::string fileName, llvm::json::Value &output)
+{
+    std::ifstream file(fileName);
+    if (!file)
+    {
+        std::cout << "Could not read " << fileName << std::endl;
+        return false;
+    }
+
+    std::stringstream text;
+    text << file.rdbuf();
+
+    auto value = llvm::json::parse(text.str());
+    if (!value)
+    {
+        std::cout << "Could not parse " << fileName << ": " << llvm::toString(value.takeError()) << std::endl;
+        return false;
+    }
+
+    output = std::move(*value);
+    return true;
+}
+
+const llvm::json::Object *findBenchmark(const llvm::json::Value &report, llvm::StringRef name)
+{
+    const llvm::json::Array *benchmarks = report.getAsObject()->getArray("benchmarks");
+    if (!benchmarks)
+    {
+        return nullptr;
+    }
+
+    for (auto &benchmark : *benchmarks)
+    {
+        const llvm::json::Object *object = benchmark.getAsObject();
+        if (object && object->getString("name") == name)
+        {
+            return object;
+        }
+    }
+    return nullptr;
+}
+
+std::vector<double> getSamples(const llvm::json::Object &benchmark, std::string measurement)
+{
+    std::vector<double> samples;
+    const llvm::json::Object *object = benchmark.getObject(measurement);
+    if (!object || !object->getArray("samples"))
+    {
+        return samples;
+    }
+
+    for (auto &sample : *object->getArray("samples"))
+    {
+        if (auto value = sample.getAsNumber())
+        {
+            samples.push_back(*value);
+        }
+    }
+    return samples;
+}
+
+double percentChange(double before, double after)
+{
+    if (before == 0)
+    {
+        return after == 0 ? 0 : 100;
+    }
+    return (after - before) / before * 100;
+}
+
+void printRow(std::string name, double before, double after, std::string verdict)
+{
+    std::cout << std::left << std::setw(16) << "    " + name << std::right << std::fixed << std::setprecision(1);
+    std::cout << std::setw(14) << before << std::setw(14) << after << std::setw(11) << percentChange(before, after) << "%";
+    std::cout << "  " << verdict << std::endl;
+}
+
+bool parseArguments(int argc, char *argv[], CompareSettings &settings)
+{
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--threshold" && i + 1 < argc)
+        {
+            settings.threshold = std::stod(argv[++i]);
+        }
+        else if (argument[0] != '-')
+        {
+            files.push_back(argument);
+        }
+        else
+        {
+            files.clear();
+            break;
+        }
+    }
+
+    if (files.size() != 2)
+    {
+        std::cout << "Usage: benchmarkCompare <baseline.json> <new.json> [--threshold <percent>]" << std::endl;
+        return false;
+    }
+
+    settings.baselineFile = files[0];
+    settings.newFile = files[1];
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    CompareSettings settings;
+    if (!parseArguments(argc, argv, settings))
+    {
+        return 2;
+    }
+
+    llvm::json::Value baseline = nullptr;
+    llvm::json::Value current = nullptr;
+    if (!readJSON(settings.baselineFile, baseline) || !readJSON(settings.newFile, current))
+    {
+        return 2;
+    }
+
+    if (!current.getAsObject() || !current.getAsObject()->getArray("benchmarks") ||
+        !baseline.getAsObject() || !baseline.getAsObject()->getArray("benchmarks"))
+    {
+        std::cout << "Not a benchmarkTest report." << std::endl;
+        return 2;
+    }
+
+    int regressions = 0;
+    for (auto &benchmark : *current.getAsObject()->getArray("benchmarks"))
+    {
+        const llvm::json::Object *after = benchmark.getAsObject();
+        if (!after || !after->getString("name"))
+        {
+            continue;
+        }
+
+        std::string name = after->getString("name")->str();
+        std::cout << name << std::endl;
+
+        const llvm::json::Object *before = findBenchmark(baseline, name);
+        if (!before)
+        {
+            std::cout << "    not in the baseline" << std::endl << std::endl;
+            continue;
+        }
+
+        // A change only counts if it is over the threshold and not explained by noise.
+        for (auto &measurement : gatedMeasurements)
+        {
+            std::vector<double> beforeSamples = getSamples(*before, measurement);
+            std::vector<double> afterSamples = getSamples(*after, measurement);
+            if (beforeSamples.empty() || afterSamples.empty())
+            {
+                continue;
+            }
+
+            double beforeMedian = median(beforeSamples);
+            double afterMedian = median(afterSamples);
+            double change = percentChange(beforeMedian, afterMedian);
+            bool significant = isSignificant(beforeSamples, afterSamples);
+
+            std::string verdict = "";
+            if (change > settings.threshold && significant)
+            {
+                verdict = "REGRESSION";
+                regressions++;
+            }
+            else if (change < -settings.threshold && significant)
+            {
+                verdict = "improvement";
+            }
+            printRow(measurement + " us", beforeMedian, afterMedian, verdict);
+        }
+
+        // Binary size is deterministic, so any growth over the threshold counts.
+        auto beforeSize = before->getNumber("binary_size");
+        auto afterSize = after->getNumber("binary_size");
+        if (beforeSize && afterSize)
+        {
+            double change = percentChange(*beforeSize, *afterSize);
+            std::string verdict = "";
+            if (change > settings.threshold)
+            {
+                verdict = "REGRESSION";
+                regressions++;
+            }
+            printRow("binary bytes", *beforeSize, *afterSize, verdict);
+        }
+        std::cout << std::endl;
+    }
+
+    // A benchmark that stopped running, or failed, must not pass the gate unnoticed.
+    int missing = 0;
+    for (auto &benchmark : *baseline.getAsObject()->getArray("benchmarks"))
+    {
+        const llvm::json::Object *before = benchmark.getAsObject();
+        if (!before || !before->getString("name") || findBenchmark(current, *before->getString("name")))
+        {
+            continue;
+        }
+
+        std::cout << before->getString("name")->str() << std::endl;
+        std::cout << "    MISSING from the new run" << std::endl << std::endl;
+        missing++;
+    }
+
+    if (missing > 0)
+    {
+        std::cout << missing << " benchmark(s) missing from the new run." << std::endl;
+    }
+
+    if (regressions > 0)
+    {
+        std::cout << regressions << " regression(s) over " << settings.threshold << "%." << std::endl;
+        return 1;
+    }
+    if (missing > 0)
+    {
+        return 1;
+    }
+
+    std::cout << "No regressions over " << settings.threshold << "%." << std::endl;
+    return 0;
+}
@@ -1,173 +1,500 @@
 #include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <regex>
+#include <sstream>
 
 #include <dorset-lang/Driver/CLI.h>
 
+#include <llvm/Support/JSON.h>
+
+#include "SourceGenerator.h"
+#include "Statistics.h"
+
+#if !defined(_WIN64) && !defined(_WIN32)
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
 using namespace Dorset;
 
-using std::chrono::high_resolution_clock;
-using std::chrono::duration_cast;
+using std::chrono::steady_clock;
 using std::chrono::duration;
-using std::chrono::milliseconds;
 
-void resetGlobals()
+struct BenchmarkSettings
 {
-	ErrorHandler::HadError = false;
-}
-
-void compileTest1()
+    int warmups = 1;
+    int repetitions = 5;
+    std::string jsonFile = "";
+    bool scaling = false;
+    int scalingMax = 1024;
+};
+
+struct BenchmarkResult
 {
-	resetGlobals();
+    std::string name;
+    uint64_t binarySize = 0;
+    std::map<std::string, std::vector<double>> samples; // In microseconds.
+};
+
+// Every measurement, in the order they are reported.
+static const std::vector<std::string> measurements = {
+    "compile", "frontend", "optimizer", "backend", "link", "execute", "execute_cpu"
+};
+
+// How the phases of '--time-report-json' add up to the reported compile phases.
+static const std::vector<std::pair<std::string, std::vector<std::string>>> phaseGroups = {
+    {"frontend",  {"read", "lex", "frontend"}},
+    {"optimizer", {"optimize"}},
+    {"backend",   {"targets", "emit_ir", "emit_bitcode", "emit_object"}},
+    {"link",      {"link_bitcode", "link"}},
+};
 
-	CompilerOptions options = CompilerOptions({"src/benchmarkTest_1.ds"});
-
-	Compiler compiler = Compiler(options);
-	int i = compiler.compile();
-}
-
-void runTest1()
+void resetGlobals()
 {
-#if defined(_WIN64) || defined(_WIN32)
-    system("\"benchmarkTest_1.exe\"");
-#else
-    system("./benchmarkTest_1.out");
-#endif
+	ErrorHandler::HadError = false;
 }
 
-void compileTest2()
+std::vector<std::string> discoverBenchmarks()
 {
-	resetGlobals();
-
-	CompilerOptions options = CompilerOptions({"src/benchmarkTest_2.ds"});
-
-	Compiler compiler = Compiler(options);
-	int i = compiler.compile();
+    // Every src/benchmarkTest_<N>.ds, in numeric order.
+    std::vector<std::pair<int, std::string>> found;
+    std::regex pattern("benchmarkTest_([0-9]+)\\.ds");
+    for (auto &entry : std::filesystem::directory_iterator("src"))
+    {
+        std::smatch match;
+        std::string fileName = entry.path().filename().string();
+        if (std::regex_match(fileName, match, pattern))
+        {
+            found.push_back({std::stoi(match[1]), fileName});
+        }
+    }
+    std::sort(found.begin(), found.end());
+
+    std::vector<std::string> benchmarks;
+    for (auto &benchmark : found)
+    {
+        benchmarks.push_back(benchmark.second);
+    }
+    return benchmarks;
 }
 
-void runTest2()
+std::string getBinaryName(std::string benchmark)
 {
+    std::string name = std::filesystem::path(benchmark).stem().string();
 #if defined(_WIN64) || defined(_WIN32)
-    system("\"benchmarkTest_2.exe\"");
+    return name + ".exe";
 #else
-    system("./benchmarkTest_2.out");
+    return "./" + name + ".out";
 #endif
 }
 
-void compileTest3()
+bool compileBenchmark(std::string source, BenchmarkResult &result)
 {
-	resetGlobals();
-
-	CompilerOptions options = CompilerOptions({"src/benchmarkTest_3.ds"});
-
-	Compiler compiler = Compiler(options);
-	int i = compiler.compile();
+    resetGlobals();
+
+    std::string reportFile = "benchmarkReport.json";
+    CompilerOptions options = CompilerOptions({source, "--time-report-json", reportFile});
+    Compiler compiler = Compiler(options);
+
+    auto t1 = steady_clock::now();
+    int status = compiler.compile();
+    auto t2 = steady_clock::now();
+    if (status != 0)
+    {
+        return false;
+    }
+    result.samples["compile"].push_back(duration<double, std::micro>(t2 - t1).count());
+
+    // Split the compile up with the compiler's own phase timers.
+    std::ifstream file(reportFile);
+    std::stringstream text;
+    text << file.rdbuf();
+
+    auto report = llvm::json::parse(text.str());
+    if (!report)
+    {
+        llvm::consumeError(report.takeError());
+        return false;
+    }
+
+    llvm::json::Object *timers = report->getAsObject();
+    for (auto &group : phaseGroups)
+    {
+        double seconds = 0;
+        for (auto &phase : group.second)
+        {
+            if (auto value = timers->getNumber("time.dorsetc." + phase + ".wall"))
+            {
+                seconds += *value;
+            }
+        }
+        result.samples[group.first].push_back(seconds * 1e6);
+    }
+
+    result.binarySize = std::filesystem::file_size(getBinaryName(source));
+    return true;
 }
 
-void runTest3()
+bool runBenchmark(std::string benchmark, BenchmarkResult &result)
 {
+    std::string binary = getBinaryName(benchmark);
+
 #if defined(_WIN64) || defined(_WIN32)
-    system("\"benchmarkTest_3.exe\"");
+    auto t1 = steady_clock::now();
+    int status = system(("\"" + binary + "\" > NUL").c_str());
+    auto t2 = steady_clock::now();
+    result.samples["execute"].push_back(duration<double, std::micro>(t2 - t1).count());
+    return status == 0;
 #else
-    system("./benchmarkTest_3.out");
+    // Spawn the program directly rather than through a shell, and keep its output out of the report.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char *argv[] = { (char *)binary.c_str(), nullptr };
+    pid_t pid;
+
+    auto t1 = steady_clock::now();
+    int spawned = posix_spawn(&pid, binary.c_str(), &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawned != 0)
+    {
+        return false;
+    }
+
+    int status;
+    rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid)
+    {
+        return false;
+    }
+    auto t2 = steady_clock::now();
+
+    result.samples["execute"].push_back(duration<double, std::micro>(t2 - t1).count());
+
+    // The CPU time of the program alone, without the cost of spawning it.
+    double cpu = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    result.samples["execute_cpu"].push_back(cpu);
+
+    // A program that crashed or failed did not run the benchmark to the end.
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
 #endif
 }
 
-void compileTest4()
+void printResult(BenchmarkResult &result)
 {
-	resetGlobals();
-
-	CompilerOptions options = CompilerOptions({"src/benchmarkTest_4.ds"});
-
-	Compiler compiler = Compiler(options);
-	int i = compiler.compile();
+    std::cout << result.name << " (binary " << result.binarySize << " bytes)" << std::endl;
+    std::cout << std::left << std::setw(16) << "    Measurement" << std::right;
+    std::cout << std::setw(14) << "Median (us)" << std::setw(14) << "p95 (us)" << std::setw(14) << "Stddev (us)" << std::endl;
+
+    for (auto &measurement : measurements)
+    {
+        if (result.samples[measurement].empty())
+        {
+            continue;
+        }
+
+        Summary summary = summarize(result.samples[measurement]);
+        std::cout << std::left << std::setw(16) << "    " + measurement << std::right << std::fixed << std::setprecision(1);
+        std::cout << std::setw(14) << summary.median << std::setw(14) << summary.p95 << std::setw(14) << summary.stddev << std::endl;
+    }
+    std::cout << std::endl;
 }
 
-void runTest4()
+void writeJSON(BenchmarkSettings &settings, std::vector<BenchmarkResult> &results)
 {
-#if defined(_WIN64) || defined(_WIN32)
-    system("\"benchmarkTest_4.exe\"");
-#else
-    system("./benchmarkTest_4.out");
-#endif
+    std::error_code EC;
+    llvm::raw_fd_ostream file(settings.jsonFile, EC, llvm::sys::fs::OF_Text);
+    if (EC)
+    {
+        std::cout << "Could not write " << settings.jsonFile << std::endl;
+        return;
+    }
+
+    llvm::json::OStream json(file, 2);
+    json.object([&]
+    {
+        json.attribute("warmups", settings.warmups);
+        json.attribute("repetitions", settings.repetitions);
+        json.attributeArray("benchmarks", [&]
+        {
+            for (auto &result : results)
+            {
+                json.object([&]
+                {
+                    json.attribute("name", result.name);
+                    json.attribute("binary_size", (int64_t)result.binarySize);
+                    for (auto &measurement : measurements)
+                    {
+                        if (result.samples[measurement].empty())
+                        {
+                            continue;
+                        }
+
+                        Summary summary = summarize(result.samples[measurement]);
+                        json.attributeObject(measurement, [&]
+                        {
+                            json.attribute("median", summary.median);
+                            json.attribute("p95", summary.p95);
+                            json.attribute("stddev", summary.stddev);
+                            json.attribute("mean", summary.mean);
+                            json.attributeArray("samples", [&]
+                            {
+                                for (double sample : result.samples[measurement])
+                                {
+                                    json.value(sample);
+                                }
+                            });
+                        });
+                    }
+                });
+            }
+        });
+    });
+    file << "\n";
 }
 
-void timeBenchmark1()
+/// ScalingDimension - One size of the generated programs that a scaling sweep doubles.
+struct ScalingDimension
 {
-    std::cout << "Source File 1" << std::endl;
-
-    auto t1 = high_resolution_clock::now();
-    compileTest1();
-    auto t2 = high_resolution_clock::now();
-    auto durationCompile = duration_cast<milliseconds>(t2 - t1);
-    std::cout << "Compilation Time: " << durationCompile.count() << "ms" << std::endl;
-
-    t1 = high_resolution_clock::now();
-    runTest1();
-    t2 = high_resolution_clock::now();
-    auto durationExecute = duration_cast<milliseconds>(t2 - t1);
-    std::cout << "Execution Time: "<< durationExecute.count() << "ms" << std::endl;
-    std::cout << std::endl;
+    std::string name;
+    int GeneratorSettings::*size;
+    int start;
+};
+
+// Every dimension is swept on its own, the others stay at a small fixed size, so
+// the growth of the compile time is the cost of that dimension alone.
+static const std::vector<ScalingDimension> scalingDimensions = {
+    {"functions",         &GeneratorSettings::functions,        64},
+    {"if_depth",          &GeneratorSettings::ifDepth,           2},
+    {"expression_length", &GeneratorSettings::expressionLength,  8},
+    {"array_size",        &GeneratorSettings::arraySize,        16},
+};
+
+/// The slope of a least squares fit of log2(time) against log2(size).
+double growthExponent(const std::vector<double> &sizes, const std::vector<double> &times)
+{
+    std::vector<double> x, y;
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        x.push_back(std::log2(sizes[i]));
+        y.push_back(std::log2(times[i]));
+    }
+
+    double meanX = mean(x);
+    double meanY = mean(y);
+    double covariance = 0;
+    double spread = 0;
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        covariance += (x[i] - meanX) * (y[i] - meanY);
+        spread += (x[i] - meanX) * (x[i] - meanX);
+    }
+    return spread == 0 ? 0 : covariance / spread;
 }
 
-void timeBenchmark2()
+bool runSweep(BenchmarkSettings &settings, const ScalingDimension &dimension, std::filesystem::path directory,
+              std::vector<std::string> &generated, std::vector<BenchmarkResult> &results)
 {
-    std::cout << "Source File 2" << std::endl;
-
-    auto t1 = high_resolution_clock::now();
-    compileTest2();
-    auto t2 = high_resolution_clock::now();
-    auto durationCompile = duration_cast<milliseconds>(t2 - t1);
-    std::cout << "Compilation Time: " << durationCompile.count() << "ms" << std::endl;
-
-    t1 = high_resolution_clock::now();
-    runTest2();
-    t2 = high_resolution_clock::now();
-    auto durationExecute = duration_cast<milliseconds>(t2 - t1);
-    std::cout << "Execution Time: "<< durationExecute.count() << "ms" << std::endl;
-    std::cout << std::endl;
+    // Compile time against one dimension of the program, doubling it each step.
+    // An exponent near 1 is linear, near 2 is quadratic.
+    std::cout << std::left << std::setw(20) << dimension.name << std::right << std::setw(12) << "Bytes";
+    std::cout << std::setw(16) << "Compile (us)" << std::setw(16) << "Exponent";
+    std::cout << std::setw(16) << "Front end (us)" << std::setw(16) << "Exponent" << std::endl;
+
+    // --scaling-max bounds the number of functions, the other sweeps take as many steps.
+    int steps = 1;
+    for (int functions = 64; functions * 2 <= settings.scalingMax; functions *= 2)
+    {
+        steps++;
+    }
+
+    std::vector<double> sizes, compiles, frontends;
+    for (int step = 0, size = dimension.start; step < steps; step++, size *= 2)
+    {
+        GeneratorSettings generator;
+        generator.functions = 16;
+        generator.operators = operatorSymbols.size();
+        generator.*dimension.size = size;
+
+        std::string name = "generated_" + dimension.name + "_" + std::to_string(size);
+        std::string source = (directory / (name + ".ds")).string();
+        generated.push_back(source);
+        std::ofstream file(source);
+        file << generateSource(generator);
+        file.close();
+
+        BenchmarkResult result;
+        result.name = name;
+        for (int run = 0; run < settings.warmups + settings.repetitions; run++)
+        {
+            BenchmarkResult discarded;
+            BenchmarkResult &target = run < settings.warmups ? discarded : result;
+            if (!compileBenchmark(source, target))
+            {
+                std::cout << "Benchmark failed: " << source << std::endl;
+                return false;
+            }
+        }
+
+        double compile = median(result.samples["compile"]);
+        double frontend = median(result.samples["frontend"]);
+
+        std::cout << std::left << std::setw(20) << size << std::right << std::setw(12) << std::filesystem::file_size(source);
+        std::cout << std::fixed << std::setprecision(1) << std::setw(16) << compile << std::setprecision(2);
+        if (!compiles.empty())
+        {
+            std::cout << std::setw(16) << std::log2(compile / compiles.back());
+        }
+        else
+        {
+            std::cout << std::setw(16) << "-";
+        }
+        std::cout << std::setprecision(1) << std::setw(16) << frontend << std::setprecision(2);
+        if (!frontends.empty())
+        {
+            std::cout << std::setw(16) << std::log2(frontend / frontends.back());
+        }
+        else
+        {
+            std::cout << std::setw(16) << "-";
+        }
+        std::cout << std::endl;
+
+        sizes.push_back(size);
+        compiles.push_back(compile);
+        frontends.push_back(frontend);
+        results.push_back(result);
+    }
+
+    std::cout << std::left << std::setw(20) << "Growth exponent" << std::right << std::setw(12) << "";
+    std::cout << std::setw(16) << "" << std::setw(16) << growthExponent(sizes, compiles);
+    std::cout << std::setw(16) << "" << std::setw(16) << growthExponent(sizes, frontends) << std::endl << std::endl;
+    return true;
 }
 
-void timeBenchmark3()
+bool runScaling(BenchmarkSettings &settings, std::vector<BenchmarkResult> &results)
 {
-    std::cout << "Source File 3" << std::endl;
-
-    auto t1 = high_resolution_clock::now();
-    compileTest3();
-    auto t2 = high_resolution_clock::now();
-    auto durationCompile = duration_cast<milliseconds>(t2 - t1);
-    std::cout << "Compilation Time: " << durationCompile.count() << "ms" << std::endl;
-
-    t1 = high_resolution_clock::now();
-    runTest3();
-    t2 = high_resolution_clock::now();
-    auto durationExecute = duration_cast<milliseconds>(t2 - t1);
-    std::cout << "Execution Time: "<< durationExecute.count() << "ms" << std::endl;
-    std::cout << std::endl;
+    // The generated sources go to the temporary directory, the binaries are
+    // written next to the other benchmarks', and both are removed afterwards.
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "dorset-scaling";
+    std::filesystem::create_directories(directory);
+    std::vector<std::string> generated;
+
+    bool succeeded = true;
+    for (auto &dimension : scalingDimensions)
+    {
+        if (!runSweep(settings, dimension, directory, generated, results))
+        {
+            succeeded = false;
+            break;
+        }
+    }
+
+    std::error_code ec;
+    for (auto &source : generated)
+    {
+        std::filesystem::remove(getBinaryName(source), ec);
+    }
+    std::filesystem::remove_all(directory, ec);
+    return succeeded;
 }
 
-void timeBenchmark4()
+bool parseArguments(int argc, char *argv[], BenchmarkSettings &settings)
 {
-    std::cout << "Source File 4" << std::endl; 
-
-    auto t1 = high_resolution_clock::now();
-    compileTest4();
-    auto t2 = high_resolution_clock::now();
-    auto durationCompile = duration_cast<milliseconds>(t2 - t1);
-    std::cout << "Compilation Time: " << durationCompile.count() << "ms" << std::endl;
-
-    t1 = high_resolution_clock::now();
-    runTest4();
-    t2 = high_resolution_clock::now();
-    auto durationExecute = duration_cast<milliseconds>(t2 - t1);
-    std::cout << "Execution Time: "<< durationExecute.count() << "ms" << std::endl;
-    std::cout << std::endl;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--scaling")
+        {
+            settings.scaling = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::cout << "No value given to " << argument << std::endl;
+            return false;
+        }
+
+        if (argument == "--warmups")
+        {
+            settings.warmups = std::stoi(argv[++i]);
+        }
+        else if (argument == "--repetitions")
+        {
+            settings.repetitions = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (argument == "--json")
+        {
+            settings.jsonFile = argv[++i];
+        }
+        else if (argument == "--scaling-max")
+        {
+            settings.scalingMax = std::stoi(argv[++i]);
+            settings.scaling = true;
+        }
+        else
+        {
+            std::cout << "Usage: benchmarkTest [--warmups <n>] [--repetitions <n>] [--json <file>]" << std::endl;
+            std::cout << "                     [--scaling] [--scaling-max <functions>]" << std::endl;
+            return false;
+        }
+    }
+    return true;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-    timeBenchmark1();
-    timeBenchmark2();
-    timeBenchmark3();
-    timeBenchmark4();
+    BenchmarkSettings settings;
+    if (!parseArguments(argc, argv, settings))
+    {
+        return 1;
+    }
+
+    std::vector<BenchmarkResult> results;
+    if (settings.scaling)
+    {
+        if (!runScaling(settings, results))
+        {
+            return 1;
+        }
+    }
+
+    for (auto &benchmark : settings.scaling ? std::vector<std::string>() : discoverBenchmarks())
+    {
+        BenchmarkResult result;
+        result.name = std::filesystem::path(benchmark).stem().string();
+
+        // Warmups fill the caches and are thrown away.
+        for (int run = 0; run < settings.warmups + settings.repetitions; run++)
+        {
+            BenchmarkResult discarded;
+            BenchmarkResult &target = run < settings.warmups ? discarded : result;
+            if (!compileBenchmark("src/" + benchmark, target) || !runBenchmark(benchmark, target))
+            {
+                std::cout << "Benchmark failed: " << benchmark << std::endl;
+                return 1;
+            }
+        }
+
+        printResult(result);
+        results.push_back(result);
+    }
+
+    if (settings.jsonFile != "")
+    {
+        writeJSON(settings, results);
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,7 +1,27 @@
 #define CATCH_CONFIG_MAIN
 #include <dorset-lang/catch.hpp>
 
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+
 #include <dorset-lang/Driver/CLI.h>
+#include <dorset-lang/Driver/JitSession.h>
+#include <dorset-lang/Driver/Repl.h>
+#include <dorset-lang/Driver/Server.h>
+
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/ProfileData/InstrProfReader.h>
+#include <llvm/ProfileData/InstrProfWriter.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/VirtualFileSystem.h>
+
+#if !defined(_WIN64) && !defined(_WIN32)
+#include <unistd.h>
+#endif
 
 using namespace Dorset;
 
@@ -10,6 +30,53 @@ void resetGlobals()
 	ErrorHandler::HadError = false;
 }
 
+std::map<std::string, std::filesystem::file_time_type> getModificationTimes(std::string directory)
+{
+	std::map<std::string, std::filesystem::file_time_type> times;
+	for (auto &entry : std::filesystem::recursive_directory_iterator(directory))
+	{
+		if (entry.is_regular_file())
+		{
+			times[entry.path().string()] = entry.last_write_time();
+		}
+	}
+	return times;
+}
+
+std::string readFile(std::string path)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream contents;
+	contents << file.rdbuf();
+	return contents.str();
+}
+
+std::map<std::string, long long> runForProfile(std::string binary, std::string profile)
+{
+	// The calls column of every function in the flat profile the binary writes at exit.
+	std::map<std::string, long long> calls;
+	std::filesystem::remove(profile);
+	if (system(("DORSET_PROFILE=" + profile + " ./" + binary + " > /dev/null").c_str()) != 0)
+	{
+		return calls;
+	}
+
+	std::ifstream file(profile);
+	std::string line;
+	std::getline(file, line);
+	while (std::getline(file, line))
+	{
+		std::stringstream row(line);
+		std::string name;
+		long long count;
+		if (row >> name >> count)
+		{
+			calls[name] = count;
+		}
+	}
+	return calls;
+}
+
 
 TEST_CASE("Basic Hello World [1]", "[Compile]") // compileTest_1.ds
 {
@@ -56,6 +123,27 @@ TEST_CASE("Returns [3]", "[Compile]") // compileTest_3.ds
 	REQUIRE(i == 0);
 }
 
+TEST_CASE("Exit Status", "[Compile]")
+{
+	// Pre Work
+	resetGlobals();
+
+	// Whatever main returns, a program that finishes exits with 0.
+	CompilerOptions options = CompilerOptions({"-rs", "fn main() double { print(\"exiting\"); return 42; }", "-o", "exitStatus"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	REQUIRE(compiler.compile() == 0);
+	REQUIRE(system("./exitStatus > /dev/null") == 0);
+
+	resetGlobals();
+	CompilerOptions voidOptions = CompilerOptions({"-rs", "fn main() void { print(\"exiting\"); }", "-o", "voidExitStatus"});
+	Compiler voidCompiler = Compiler(voidOptions);
+	REQUIRE(voidCompiler.compile() == 0);
+	REQUIRE(system("./voidExitStatus > /dev/null") == 0);
+}
+
 TEST_CASE("Variable and If Statement [4]", "[Compile]") // compileTest_4.ds
 {
 	// Pre Work
@@ -219,4 +307,791 @@ TEST_CASE("'==' Operator [14]", "[Compile]") // compileTest_14.ds
 	int i = compiler.compile();
 
 	REQUIRE(i == 0);
+}
+
+TEST_CASE("For Loop Induction Variable [15]", "[Compile]") // compileTest_15.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_15.ds"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+}
+
+TEST_CASE("Bool Type and Logical Operators [16]", "[Compile]") // compileTest_16.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_16.ds"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+}
+
+TEST_CASE("Number Assigned to Bool", "[Compile]")
+{
+	// Pre Work
+	resetGlobals();
+
+	// 'c' is a bool, so 'c + 1' has to be compared explicitly before it is stored.
+	CompilerOptions options = CompilerOptions({"-rs", "fn main() void { var c = 1 < 2; c = c + 1; }"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 1);
+
+	resetGlobals();
+
+	CompilerOptions comparedOptions = CompilerOptions({"-rs", "fn main() void { var c = 1 < 2; c = c + 1 != 0; }"});
+	Compiler comparedCompiler = Compiler(comparedOptions);
+	REQUIRE(comparedCompiler.compile() == 0);
+}
+
+TEST_CASE("Arithmetic and Comparison Operators [17]", "[Compile]") // compileTest_17.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_17.ds"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+}
+
+TEST_CASE("Exported Functions [18]", "[Compile]") // compileTest_18.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_18.ds"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+}
+
+TEST_CASE("Compilation Cache", "[Cache]") // compileTest_1.ds
+{
+	// Pre Work
+	resetGlobals();
+	std::filesystem::remove_all("compilationCache");
+
+	// The first build fills the cache, the second is restored from it.
+	std::map<std::string, std::filesystem::file_time_type> stored;
+	for (int build = 0; build < 2; build++)
+	{
+		std::filesystem::remove("compileTest_1.out");
+
+		CompilerOptions options = CompilerOptions({"src/compileTest_1.ds", "--cache-dir", "compilationCache"});
+
+		REQUIRE(options.getHadError() == false);
+
+		Compiler compiler = Compiler(options);
+		int i = compiler.compile();
+
+		REQUIRE(i == 0);
+		REQUIRE(std::filesystem::exists("compileTest_1.out"));
+
+		if (build == 0)
+		{
+			stored = getModificationTimes("compilationCache");
+			REQUIRE(!stored.empty());
+		}
+	}
+
+	// A hit restores the entries without storing them again.
+	REQUIRE(getModificationTimes("compilationCache") == stored);
+}
+
+TEST_CASE("Function Cache", "[Cache]")
+{
+	// The second build only changes 'main', so 'add' is linked back in from the cache.
+	std::vector<std::string> sources = {
+		"fn add(x, y) double { return x + y; } fn main() void { printf(\"%f\", add(1, 2)); }",
+		"fn add(x, y) double { return x + y; } fn main() void { printf(\"%f\", add(3, 4)); }"
+	};
+
+	std::filesystem::remove_all("functionCache");
+
+	std::map<std::string, std::filesystem::file_time_type> stored;
+	for (auto &source : sources)
+	{
+		resetGlobals();
+		CompilerOptions options = CompilerOptions({"-rs", source, "--cache-dir", "functionCache"});
+
+		REQUIRE(options.getHadError() == false);
+
+		Compiler compiler = Compiler(options);
+		int i = compiler.compile();
+
+		REQUIRE(i == 0);
+		REQUIRE(std::filesystem::exists("output.out"));
+
+		if (stored.empty())
+		{
+			stored = getModificationTimes("functionCache");
+		}
+	}
+
+	// Lowering 'add' again would have stored its bitcode again.
+	auto times = getModificationTimes("functionCache");
+	REQUIRE(times.size() > stored.size());
+	for (auto &entry : stored)
+	{
+		REQUIRE(times[entry.first] == entry.second);
+	}
+
+	// A function added above 'add' is not one 'add' calls, so only it and 'main' are lowered.
+	auto countBitcode = [](const std::map<std::string, std::filesystem::file_time_type> &entries)
+	{
+		int count = 0;
+		for (auto &entry : entries)
+		{
+			if (std::filesystem::path(entry.first).extension() == ".bc")
+			{
+				count++;
+			}
+		}
+		return count;
+	};
+
+	resetGlobals();
+	CompilerOptions options = CompilerOptions({"-rs", "fn scale(x) double { return x * 2; } fn add(x, y) double { return x + y; } fn main() void { printf(\"%f\", add(5, 6)); }", "--cache-dir", "functionCache"});
+	Compiler compiler = Compiler(options);
+	REQUIRE(compiler.compile() == 0);
+	REQUIRE(countBitcode(getModificationTimes("functionCache")) == countBitcode(times) + 2);
+}
+
+TEST_CASE("Client Without Server", "[Server]") // compileTest_1.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	// Nothing listens on the socket, so the client compiles in process.
+	CompilerOptions options = CompilerOptions({"src/compileTest_1.ds", "--client", "--socket", "no-server.sock"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+	REQUIRE(std::filesystem::exists("compileTest_1.out"));
+}
+
+#if !defined(_WIN64) && !defined(_WIN32)
+TEST_CASE("Compile Server", "[Server]") // compileTest_1.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	// The server only listens from a directory private to the user.
+	std::filesystem::path directory = std::filesystem::temp_directory_path() / ("dorsetc-test-" + std::to_string(getpid()));
+	std::filesystem::create_directory(directory);
+	std::filesystem::permissions(directory, std::filesystem::perms::owner_all);
+	std::string socketPath = (directory / "dorsetc.sock").string();
+
+	std::thread([socketPath] { CompileServer(socketPath).run(); }).detach();
+	for (int attempt = 0; attempt < 100 && !std::filesystem::exists(socketPath); attempt++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	REQUIRE(std::filesystem::exists(socketPath));
+
+	// Collects what the client replays, the server captures its own output separately.
+	auto forward = [socketPath](std::vector<std::string> arguments, std::string &output)
+	{
+		std::cout.flush();
+		int savedOut = dup(STDOUT_FILENO);
+		FILE *capture = std::fopen("serverOutput.txt", "w");
+		dup2(fileno(capture), STDOUT_FILENO);
+
+		int status = forwardToServer(socketPath, arguments);
+
+		std::cout.flush();
+		dup2(savedOut, STDOUT_FILENO);
+		close(savedOut);
+		std::fclose(capture);
+
+		output = readFile("serverOutput.txt");
+		return status;
+	};
+
+	std::filesystem::remove("compileTest_1.out");
+
+	std::string output;
+	REQUIRE(forward({"src/compileTest_1.ds", "-t"}, output) == 0);
+	REQUIRE(output.find("main") != std::string::npos);
+	REQUIRE(std::filesystem::exists("compileTest_1.out"));
+
+	// A failed compile replays its status and diagnostics.
+	REQUIRE(forward({"-rs", "fn main() void { print(missing); }"}, output) == 1);
+	REQUIRE(output.find("missing") != std::string::npos);
+
+	// The REPL needs the client's terminal, the server refuses it.
+	REQUIRE(forward({"--repl"}, output) == 1);
+	REQUIRE(output.find("REPL") != std::string::npos);
+}
+#endif
+
+TEST_CASE("Time Report", "[Report]") // compileTest_1.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_1.ds", "--time-report-json", "timeReport.json"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+	REQUIRE(std::filesystem::exists("timeReport.json"));
+
+	llvm::Expected<llvm::json::Value> parsed = llvm::json::parse(readFile("timeReport.json"));
+	REQUIRE((bool)parsed);
+	llvm::json::Object *report = parsed->getAsObject();
+	REQUIRE(report != nullptr);
+
+	// The front end, optimizer, back end and link each have their own phase timer.
+	for (std::string phase : {"frontend", "optimize", "emit_object", "link"})
+	{
+		INFO(phase);
+		auto wall = report->getNumber("time.dorsetc." + phase + ".wall");
+		REQUIRE((bool)wall);
+		REQUIRE(*wall > 0);
+	}
+
+	for (std::string count : {"tokens", "ast_nodes", "ir_instructions", "peak_rss_kb"})
+	{
+		INFO(count);
+		auto value = report->getNumber(count);
+		REQUIRE((bool)value);
+		REQUIRE(*value > 0);
+	}
+}
+
+TEST_CASE("Time Trace", "[Report]") // compileTest_1.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_1.ds", "-ftime-trace=timeTrace.json"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+	REQUIRE(std::filesystem::exists("timeTrace.json"));
+
+	// Phases and the codegen of each function are named in the trace.
+	std::string trace = readFile("timeTrace.json");
+	REQUIRE(trace.find("\"traceEvents\"") != std::string::npos);
+	REQUIRE(trace.find("\"Optimization\"") != std::string::npos);
+	REQUIRE(trace.find("\"FunctionAST::codegen\"") != std::string::npos);
+	REQUIRE(trace.find("\"detail\":\"main\"") != std::string::npos);
+}
+
+TEST_CASE("Missing Profile", "[Profile]") // compileTest_1.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_1.ds", "-fprofile-use=missing.profdata"});
+
+	REQUIRE(options.getHadError() == true);
+}
+
+TEST_CASE("Profile Generate", "[Profile]") // compileTest_1.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	// Without linking, so clang's profile runtime is not needed.
+	CompilerOptions options = CompilerOptions({"src/compileTest_1.ds", "-fprofile-generate=compileTest_1.profraw", "-c", "-r"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+
+	// The optimized IR counts the edges of 'main' and names the profile to write.
+	std::string ir = readFile("compileTest_1.ll");
+	REQUIRE(ir.find("__profc_main") != std::string::npos);
+	REQUIRE(ir.find("compileTest_1.profraw") != std::string::npos);
+}
+
+TEST_CASE("Profile Use", "[Profile]")
+{
+	// Pre Work
+	resetGlobals();
+
+	std::string source = "fn main() double { var sum = 0; for (var i = 0, i < 100, 1.0) { if (i < 90) { sum = sum + 1; } else { sum = sum - 1; } } return sum; }";
+
+	CompilerOptions generateOptions = CompilerOptions({"-rs", source, "-o", "profileUse", "-fprofile-generate=profileUse.profraw"});
+	Compiler generateCompiler = Compiler(generateOptions);
+	REQUIRE(generateCompiler.compile() == 0);
+
+	std::filesystem::remove("profileUse.profraw");
+	REQUIRE(system("./profileUse > /dev/null") == 0);
+	REQUIRE(std::filesystem::exists("profileUse.profraw"));
+
+	// Merged into an indexed profile, as 'llvm-profdata merge' would.
+	auto reader = llvm::InstrProfReader::create("profileUse.profraw", *llvm::vfs::getRealFileSystem());
+	REQUIRE((bool)reader);
+	llvm::InstrProfWriter writer;
+	REQUIRE(!writer.mergeProfileKind((*reader)->getProfileKind()));
+	for (auto &record : **reader)
+	{
+		writer.addRecord(std::move(record), [](llvm::Error error) { llvm::consumeError(std::move(error)); });
+	}
+	REQUIRE(!(*reader)->hasError());
+	{
+		std::error_code ec;
+		llvm::raw_fd_ostream profile("profileUse.profdata", ec);
+		REQUIRE(!ec);
+		REQUIRE(!writer.write(profile));
+	}
+
+	// The loop and the branch in it are weighted with the counts.
+	resetGlobals();
+	CompilerOptions useOptions = CompilerOptions({"-rs", source, "-o", "profileUse", "-fprofile-use=profileUse.profdata", "-c", "-r"});
+	REQUIRE(useOptions.getHadError() == false);
+	Compiler useCompiler = Compiler(useOptions);
+	REQUIRE(useCompiler.compile() == 0);
+
+	std::string ir = readFile("profileUse.ll");
+	REQUIRE(ir.find("!prof") != std::string::npos);
+	REQUIRE(ir.find("!\"branch_weights\"") != std::string::npos);
+}
+
+TEST_CASE("Instrument Functions", "[Profile]") // compileTest_1.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_1.ds", "-finstrument-functions"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+
+	auto calls = runForProfile("compileTest_1.out", "instrumentFunctions.prof");
+	REQUIRE(calls["main"] == 1);
+}
+
+TEST_CASE("Debug Info", "[Debug]") // compileTest_1.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	// Keep the object, the DWARF sections are read back from it.
+	CompilerOptions options = CompilerOptions({"src/compileTest_1.ds", "-g", "-c"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+
+	auto object = llvm::object::ObjectFile::createObjectFile("compileTest_1.o");
+	REQUIRE(bool(object));
+
+	bool hasDebugInfo = false;
+	for (auto &section : object->getBinary()->sections())
+	{
+		auto name = section.getName();
+		if (name && (*name == ".debug_info" || *name == "__debug_info"))
+		{
+			hasDebugInfo = true;
+		}
+	}
+	REQUIRE(hasDebugInfo);
+}
+
+TEST_CASE("Multiple Files [19, 20]", "[Compile]") // compileTest_19.ds, compileTest_20.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_19.ds", "src/compileTest_20.ds"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+}
+
+TEST_CASE("Link Time Optimization [19, 20]", "[Compile]") // compileTest_19.ds, compileTest_20.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	// Keep the intermediates, each file is lowered to bitcode instead of an object.
+	CompilerOptions options = CompilerOptions({"src/compileTest_19.ds", "src/compileTest_20.ds", "-flto", "-b"});
+
+	REQUIRE(options.getHadError() == false);
+
+	std::filesystem::remove("compileTest_19.lto.bc");
+	std::filesystem::remove("compileTest_20.lto.bc");
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+	REQUIRE(std::filesystem::exists("compileTest_19.lto.bc"));
+	REQUIRE(std::filesystem::exists("compileTest_20.lto.bc"));
+
+	// Without '-b' the bitcode is removed after linking.
+	resetGlobals();
+
+	CompilerOptions cleanOptions = CompilerOptions({"src/compileTest_19.ds", "src/compileTest_20.ds", "-flto"});
+	Compiler cleanCompiler = Compiler(cleanOptions);
+	REQUIRE(cleanCompiler.compile() == 0);
+	REQUIRE(!std::filesystem::exists("compileTest_19.lto.bc"));
+	REQUIRE(!std::filesystem::exists("compileTest_20.lto.bc"));
+}
+
+TEST_CASE("Instrument Multiple Files [19, 20]", "[Profile]") // compileTest_19.ds, compileTest_20.ds
+{
+	// Both files count their functions into the one profile, linked as objects or with -flto.
+	for (std::string lto : {"", "-flto"})
+	{
+		resetGlobals();
+
+		std::vector<std::string> arguments = {"src/compileTest_19.ds", "src/compileTest_20.ds", "-finstrument-functions"};
+		if (lto != "")
+		{
+			arguments.push_back(lto);
+		}
+		CompilerOptions options = CompilerOptions(arguments);
+
+		REQUIRE(options.getHadError() == false);
+
+		Compiler compiler = Compiler(options);
+		int i = compiler.compile();
+
+		REQUIRE(i == 0);
+
+		auto calls = runForProfile("compileTest_19.out", "instrumentMultipleFiles.prof");
+		REQUIRE(calls["main"] == 1);
+		REQUIRE(calls["square"] == 1);
+	}
+}
+
+TEST_CASE("Same File Names [20, 22]", "[Compile]") // compileTest_22.ds, compileTest_20.ds, modules/compileTest_20.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	std::filesystem::remove("compileTest_20.o");
+	std::filesystem::remove("compileTest_20.2.o");
+	std::filesystem::remove("compileTest_22.out");
+
+	// Both compileTest_20.ds files keep an object of their own.
+	CompilerOptions options = CompilerOptions({"src/compileTest_22.ds", "src/compileTest_20.ds", "src/modules/compileTest_20.ds", "-c"});
+	Compiler compiler = Compiler(options);
+	REQUIRE(compiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("compileTest_20.o"));
+	REQUIRE(std::filesystem::exists("compileTest_20.2.o"));
+
+	// And link into one program, which needs 'square' from one and 'cube' from the other.
+	resetGlobals();
+
+	CompilerOptions linkOptions = CompilerOptions({"src/compileTest_22.ds", "src/compileTest_20.ds", "src/modules/compileTest_20.ds"});
+	Compiler linkCompiler = Compiler(linkOptions);
+	REQUIRE(linkCompiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("compileTest_22.out"));
+}
+
+TEST_CASE("Import [20, 21]", "[Compile]") // compileTest_20.ds, compileTest_21.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_21.ds", "src/compileTest_20.ds"});
+
+	REQUIRE(options.getHadError() == false);
+
+	Compiler compiler = Compiler(options);
+	int i = compiler.compile();
+
+	REQUIRE(i == 0);
+}
+
+TEST_CASE("Module Interface [20, 21]", "[Compile]") // compileTest_20.ds, compileTest_21.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_21.ds", "src/compileTest_20.ds", "--emit-interface"});
+	Compiler compiler = Compiler(options);
+	REQUIRE(compiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("src/compileTest_20.dsi"));
+
+	// The second build reads the interface instead of the source.
+	resetGlobals();
+
+	CompilerOptions importOptions = CompilerOptions({"src/compileTest_21.ds", "src/compileTest_20.ds"});
+	Compiler importCompiler = Compiler(importOptions);
+	REQUIRE(importCompiler.compile() == 0);
+}
+
+TEST_CASE("Bitcode [19, 20]", "[Compile]") // compileTest_19.ds, compileTest_20.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_19.ds", "src/compileTest_20.ds", "--emit-bc"});
+	Compiler compiler = Compiler(options);
+	REQUIRE(compiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("compileTest_19.bc"));
+	REQUIRE(std::filesystem::exists("compileTest_20.bc"));
+
+	// The bitcode is linked in place of the sources.
+	resetGlobals();
+	CompilerOptions ltoOptions = CompilerOptions({"compileTest_19.bc", "compileTest_20.bc", "-flto"});
+	Compiler ltoCompiler = Compiler(ltoOptions);
+	REQUIRE(ltoCompiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("compileTest_20.bc"));
+
+	resetGlobals();
+	CompilerOptions mixedOptions = CompilerOptions({"compileTest_19.bc", "src/compileTest_20.ds"});
+	Compiler mixedCompiler = Compiler(mixedOptions);
+	REQUIRE(mixedCompiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("compileTest_19.bc"));
+
+	// The linked program's bitcode would be named after the first input, so it has to be named with -o.
+	// The refused compile must not leave its trace profiler running for the next one.
+	auto inputTime = std::filesystem::last_write_time("compileTest_19.bc");
+
+	resetGlobals();
+	CompilerOptions overwriteOptions = CompilerOptions({"./compileTest_19.bc", "compileTest_20.bc", "-flto", "--emit-bc", "-ftime-trace=overwriteTrace.json"});
+	Compiler overwriteCompiler = Compiler(overwriteOptions);
+	REQUIRE(overwriteCompiler.compile() == 1);
+	REQUIRE(std::filesystem::last_write_time("compileTest_19.bc") == inputTime);
+
+	resetGlobals();
+	CompilerOptions namedOptions = CompilerOptions({"./compileTest_19.bc", "compileTest_20.bc", "-flto", "--emit-bc", "-o", "linkedBitcode", "-ftime-trace=linkedTrace.json"});
+	Compiler namedCompiler = Compiler(namedOptions);
+	REQUIRE(namedCompiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("linkedBitcode.bc"));
+	REQUIRE(std::filesystem::exists("linkedTrace.json"));
+	REQUIRE(std::filesystem::last_write_time("compileTest_19.bc") == inputTime);
+}
+
+TEST_CASE("Object Only [19, 20]", "[Compile]") // compileTest_19.ds, compileTest_20.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_19.ds", "src/compileTest_20.ds", "-c"});
+	Compiler compiler = Compiler(options);
+	REQUIRE(compiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("compileTest_20.o"));
+	REQUIRE(std::filesystem::exists("compileTest_19.o"));
+
+	resetGlobals();
+	CompilerOptions assemblyOptions = CompilerOptions({"src/compileTest_20.ds", "-S"});
+	Compiler assemblyCompiler = Compiler(assemblyOptions);
+	REQUIRE(assemblyCompiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("compileTest_20.s"));
+}
+
+TEST_CASE("Library [20]", "[Compile]") // compileTest_20.ds
+{
+	// Pre Work
+	resetGlobals();
+
+	CompilerOptions options = CompilerOptions({"src/compileTest_20.ds", "--library=static"});
+	Compiler compiler = Compiler(options);
+	REQUIRE(compiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("compileTest_20.a"));
+
+	resetGlobals();
+	CompilerOptions sharedOptions = CompilerOptions({"src/compileTest_20.ds", "--library=shared"});
+	Compiler sharedCompiler = Compiler(sharedOptions);
+	REQUIRE(sharedCompiler.compile() == 0);
+	REQUIRE(std::filesystem::exists("compileTest_20.so"));
+
+	resetGlobals();
+	CompilerOptions badOptions = CompilerOptions({"src/compileTest_20.ds", "--library=dynamic"});
+	REQUIRE(badOptions.getHadError() == true);
+}
+
+TEST_CASE("JIT Session", "[JIT]")
+{
+	// Pre Work
+	resetGlobals();
+
+	JitSession session;
+	auto square = session.compile("export fn square(x) double { return x * x; }").lookup<double(double)>("square");
+
+	REQUIRE(session.getHadError() == false);
+	REQUIRE(square != nullptr);
+	REQUIRE(square(3) == 9);
+
+	// Functions that are not exported stay internal to their module.
+	REQUIRE(session.compile("fn hidden(x) double { return x; }").lookup<double(double)>("hidden") == nullptr);
+}
+
+TEST_CASE("Lazy JIT Session", "[JIT]")
+{
+	// Pre Work
+	resetGlobals();
+
+	// 'broken' could never be linked, but nothing calls it, so it is never generated.
+	JitSession session;
+	session.compile("extern dorsetMissingSymbol(x) double; export fn broken(x) double { return dorsetMissingSymbol(x); } export fn square(x) double { return x * x; }");
+
+	REQUIRE(session.getHadError() == false);
+	REQUIRE(session.lookup<double(double)>("broken") != nullptr);
+
+	auto square = session.lookup<double(double)>("square");
+	REQUIRE(square != nullptr);
+	REQUIRE(square(4) == 16);
+	REQUIRE(session.getHadError() == false);
+}
+
+TEST_CASE("Eager JIT Session", "[JIT]")
+{
+	// Pre Work
+	resetGlobals();
+
+	JitSession session(JitMode::Eager);
+	auto cube = session.compile("fn square(x) double { return x * x; } export fn cube(x) double { return square(x) * x; }").lookup<double(double)>("cube");
+
+	REQUIRE(session.getHadError() == false);
+	REQUIRE(cube != nullptr);
+	REQUIRE(cube(2) == 8);
+}
+
+TEST_CASE("Tiered JIT Session", "[JIT]")
+{
+	// Pre Work
+	resetGlobals();
+
+	JitSession session(JitMode::Tiered);
+	auto cube = session.compile("fn square(x) double { return x * x; } export fn cube(x) double { return square(x) * x; }").lookup<double(double)>("cube");
+
+	REQUIRE(session.getHadError() == false);
+	REQUIRE(cube != nullptr);
+
+	// Hot enough to be recompiled part way through, the results stay the same.
+	for (int i = 0; i < 5000; i++)
+	{
+		REQUIRE(cube(2) == 8);
+		if (i % 1000 == 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+	}
+
+	// Both functions got hot, so both end up in the second tier.
+	for (int wait = 0; wait < 200 && session.getPromotedCount() < 2; wait++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	REQUIRE(session.getPromotedCount() == 2);
+	REQUIRE(cube(2) == 8);
+}
+
+TEST_CASE("REPL", "[JIT]")
+{
+	// Pre Work
+	resetGlobals();
+
+	std::stringstream input;
+	input << "fn square(x) double {" << std::endl;
+	input << "    return x * x;" << std::endl;
+	input << "}" << std::endl;
+	input << "fn quad(x) double { return square(square(x)); }" << std::endl;
+	input << "quad(2)" << std::endl;
+	input << "fn square(x) double { return x + x; }" << std::endl;
+	input << "quad(3);" << std::endl;
+
+	std::stringstream output;
+	REQUIRE(Repl().run(input, output) == 0);
+
+	// The redefinition of 'square' reaches the 'quad' compiled before it.
+	REQUIRE(output.str().find("> 16\n") != std::string::npos);
+	REQUIRE(output.str().find("> 12\n") != std::string::npos);
+}
+
+TEST_CASE("REPL Externs", "[JIT]")
+{
+	// Pre Work
+	resetGlobals();
+
+	// The extern stays declared for the expressions and definitions entered after it.
+	std::stringstream input;
+	input << "extern sqrt(x) double;" << std::endl;
+	input << "sqrt(16)" << std::endl;
+	input << "fn hypotenuse(a, b) double { return sqrt(a * a + b * b); }" << std::endl;
+	input << "hypotenuse(3, 4)" << std::endl;
+
+	std::stringstream output;
+	REQUIRE(Repl().run(input, output) == 0);
+
+	REQUIRE(output.str().find("> 4\n") != std::string::npos);
+	REQUIRE(output.str().find("> 5\n") != std::string::npos);
+}
+
+TEST_CASE("For Loop Trip Counts", "[JIT]")
+{
+	// Pre Work
+	resetGlobals();
+
+	JitSession session(JitMode::Eager);
+	session.compile(
+		"export fn countTo(n) double { var count = 0; for (var i = 0, i < n, 1.0) { count = count + 1; } return count; }"
+		"export fn countEveryOther(n) double { var count = 0; for (var i = 0, i < n, 1.0) { count = count + 1; i = i + 1; } return count; }");
+	auto countTo = session.lookup<double(double)>("countTo");
+	auto countEveryOther = session.lookup<double(double)>("countEveryOther");
+
+	REQUIRE(session.getHadError() == false);
+	REQUIRE(countTo != nullptr);
+	REQUIRE(countEveryOther != nullptr);
+
+	// The condition is checked before every iteration, including the first.
+	REQUIRE(countTo(0) == 0);
+	REQUIRE(countTo(1) == 1);
+	REQUIRE(countTo(5) == 5);
+
+	// A body that assigns to the loop variable is stepped from the assigned value.
+	REQUIRE(countEveryOther(0) == 0);
+	REQUIRE(countEveryOther(5) == 3);
+	REQUIRE(countEveryOther(6) == 3);
 }
\ No newline at end of file
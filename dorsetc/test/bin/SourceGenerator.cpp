@@ -0,0 +1,64 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "SourceGenerator.h"
+
+// Writes a synthetic Dorset program for stressing the compiler, see GeneratorSettings.
+
+int main(int argc, char *argv[])
+{
+    GeneratorSettings settings;
+    std::string output = "";
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (i + 1 >= argc)
+        {
+            argument = "";
+        }
+
+        if (argument == "--functions")
+        {
+            settings.functions = std::stoi(argv[++i]);
+        }
+        else if (argument == "--if-depth")
+        {
+            settings.ifDepth = std::stoi(argv[++i]);
+        }
+        else if (argument == "--expression-length")
+        {
+            settings.expressionLength = std::stoi(argv[++i]);
+        }
+        else if (argument == "--array-size")
+        {
+            settings.arraySize = std::stoi(argv[++i]);
+        }
+        else if (argument == "--operators")
+        {
+            settings.operators = std::stoi(argv[++i]);
+        }
+        else if (argument == "-o")
+        {
+            output = argv[++i];
+        }
+        else
+        {
+            std::cout << "Usage: sourceGenerator [--functions <n>] [--if-depth <n>] [--expression-length <n>]" << std::endl;
+            std::cout << "                       [--array-size <n>] [--operators <n>] [-o <file>]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (output == "")
+    {
+        std::cout << generateSource(settings);
+        return 0;
+    }
+
+    std::ofstream file(output);
+    file << generateSource(settings);
+    file.close();
+    return file ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// GeneratorSettings - The size and shape of a generated Dorset program.
+struct GeneratorSettings
+{
+    int functions = 100;
+    int ifDepth = 4;
+    int expressionLength = 8;
+    int arraySize = 16;
+    int operators = 0;
+};
+
+// The symbols the language allows user defined binary operators for.
+static const std::vector<std::string> operatorSymbols = { "|", "&", "^", ":", "\\" };
+
+/// Writes a valid program of 'functions' functions, each calling the one before
+/// it, with a nested if chain, a long expression and an initialized array.
+inline std::string generateSource(const GeneratorSettings &settings)
+{
+    std::stringstream source;
+    source << "// Generated --- " << settings.functions << " functions, if depth " << settings.ifDepth
+           << ", expression length " << settings.expressionLength << ", array size " << settings.arraySize
+           << ", " << settings.operators << " operators" << std::endl << std::endl;
+
+    int operatorCount = std::min<int>(settings.operators, operatorSymbols.size());
+    for (int i = 0; i < operatorCount; i++)
+    {
+        source << "fn binary" << operatorSymbols[i] << "15(a, b) double {" << std::endl;
+        source << "    return (a + b * " << (i + 2) << ") / 2;" << std::endl;
+        source << "}" << std::endl << std::endl;
+    }
+
+    // The expression chain cycles through the builtin operators and the user ones.
+    std::vector<std::string> chainOperators = { "+", "-", "*" };
+    for (int i = 0; i < operatorCount; i++)
+    {
+        chainOperators.push_back(operatorSymbols[i]);
+    }
+
+    int arraySize = std::max(settings.arraySize, 1);
+    for (int f = 0; f < settings.functions; f++)
+    {
+        source << "fn f" << f << "(x, y) double {" << std::endl;
+
+        source << "    var values[" << arraySize << "] = (";
+        for (int i = 0; i < arraySize; i++)
+        {
+            source << (i == 0 ? "" : ", ") << (f + i) % 97;
+        }
+        source << ");" << std::endl;
+
+        source << "    var e = x";
+        for (int i = 0; i < settings.expressionLength; i++)
+        {
+            source << " " << chainOperators[i % chainOperators.size()] << " " << (i % 2 == 0 ? "y" : std::to_string(i + 1));
+        }
+        source << ";" << std::endl;
+
+        source << "    var r = 0;" << std::endl;
+        for (int depth = 0; depth < settings.ifDepth; depth++)
+        {
+            std::string indent(4 * (depth + 1), ' ');
+            source << indent << "if (x < " << depth << ") {" << std::endl;
+            source << indent << "    r = r + " << depth + 1 << ";" << std::endl;
+            source << indent << "}" << std::endl;
+            source << indent << "else {" << std::endl;
+        }
+        source << std::string(4 * (settings.ifDepth + 1), ' ') << "r = r - 1;" << std::endl;
+        for (int depth = settings.ifDepth - 1; depth >= 0; depth--)
+        {
+            source << std::string(4 * (depth + 1), ' ') << "}" << std::endl;
+        }
+
+        if (f > 0)
+        {
+            source << "    r = r + f" << f - 1 << "(y, x);" << std::endl;
+        }
+        source << "    return r + e + values[" << f % arraySize << "];" << std::endl;
+        source << "}" << std::endl << std::endl;
+    }
+
+    source << "fn main() double {" << std::endl;
+    if (settings.functions > 0)
+    {
+        source << "    return f" << settings.functions - 1 << "(1, 2);" << std::endl;
+    }
+    else
+    {
+        source << "    return 0;" << std::endl;
+    }
+    source << "}" << std::endl;
+
+    return source.str();
+}
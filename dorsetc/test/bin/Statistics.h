@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/// Summary - The statistics the benchmarks report for a set of samples.
+struct Summary
+{
+    double mean = 0;
+    double median = 0;
+    double p95 = 0;
+    double stddev = 0;
+};
+
+inline double percentile(std::vector<double> samples, double fraction)
+{
+    if (samples.empty())
+    {
+        return 0;
+    }
+
+    // Nearest rank, so the result is always one of the samples.
+    std::sort(samples.begin(), samples.end());
+    size_t rank = (size_t)std::ceil(fraction * samples.size());
+    return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+}
+
+inline double median(std::vector<double> samples)
+{
+    if (samples.empty())
+    {
+        return 0;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    size_t middle = samples.size() / 2;
+    if (samples.size() % 2 == 0)
+    {
+        return (samples[middle - 1] + samples[middle]) / 2;
+    }
+    return samples[middle];
+}
+
+inline double mean(const std::vector<double> &samples)
+{
+    if (samples.empty())
+    {
+        return 0;
+    }
+
+    double sum = 0;
+    for (double sample : samples)
+    {
+        sum += sample;
+    }
+    return sum / samples.size();
+}
+
+/// Sample variance, with Bessel's correction.
+inline double variance(const std::vector<double> &samples)
+{
+    if (samples.size() < 2)
+    {
+        return 0;
+    }
+
+    double average = mean(samples);
+    double sum = 0;
+    for (double sample : samples)
+    {
+        sum += (sample - average) * (sample - average);
+    }
+    return sum / (samples.size() - 1);
+}
+
+inline Summary summarize(const std::vector<double> &samples)
+{
+    Summary summary;
+    summary.mean = mean(samples);
+    summary.median = median(samples);
+    summary.p95 = percentile(samples, 0.95);
+    summary.stddev = std::sqrt(variance(samples));
+    return summary;
+}
+
+/// Welch's t statistic for the difference of the means of two samples.
+inline double welchT(const std::vector<double> &a, const std::vector<double> &b)
+{
+    double difference = mean(b) - mean(a);
+    double error = std::sqrt(variance(a) / a.size() + variance(b) / b.size());
+    if (error == 0)
+    {
+        // Without any noise, any difference is a real one.
+        return difference == 0 ? 0 : std::copysign(INFINITY, difference);
+    }
+    return difference / error;
+}
+
+/// Welch-Satterthwaite degrees of freedom for welchT.
+inline double welchDegreesOfFreedom(const std::vector<double> &a, const std::vector<double> &b)
+{
+    double va = variance(a) / a.size();
+    double vb = variance(b) / b.size();
+    double denominator = va * va / (a.size() - 1) + vb * vb / (b.size() - 1);
+    if (denominator == 0)
+    {
+        return 1;
+    }
+    return (va + vb) * (va + vb) / denominator;
+}
+
+/// Two sided 95% critical value of Student's t distribution.
+inline double tCritical95(double degreesOfFreedom)
+{
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+
+    int df = (int)std::floor(degreesOfFreedom);
+    if (df < 1)
+    {
+        return table[0];
+    }
+    if (df <= 30)
+    {
+        return table[df - 1];
+    }
+    return 1.960;
+}
+
+/// True if the means of the samples differ at the 95% confidence level.
+inline bool isSignificant(const std::vector<double> &a, const std::vector<double> &b)
+{
+    if (a.size() < 2 || b.size() < 2)
+    {
+        return false;
+    }
+    return std::abs(welchT(a, b)) > tCritical95(welchDegreesOfFreedom(a, b));
+}